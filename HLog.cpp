@@ -8,17 +8,27 @@
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <iostream>
 #include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <algorithm>
 
 //C and C++ include
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <sched.h>
 
 //inner dependent include
-#include "utils/HLog.h"
+#include "HLog.h"
 
 #ifdef USE_LOG4CPP
 //log4cpp
@@ -53,8 +63,1188 @@
 
 //#define CONFIG_FILE_PATH
 
+//=====================================================================
+// level control
+#define HLOG_DEFAULT_LEVEL {N_DEBUG | N_INFO | N_ERROR | N_FATAL}
+std::atomic<int> g_hlogLevelMask[HLOG_MAX_CATEGORY] = {
+    HLOG_DEFAULT_LEVEL, HLOG_DEFAULT_LEVEL, HLOG_DEFAULT_LEVEL, HLOG_DEFAULT_LEVEL,
+    HLOG_DEFAULT_LEVEL, HLOG_DEFAULT_LEVEL, HLOG_DEFAULT_LEVEL, HLOG_DEFAULT_LEVEL,
+    HLOG_DEFAULT_LEVEL, HLOG_DEFAULT_LEVEL, HLOG_DEFAULT_LEVEL, HLOG_DEFAULT_LEVEL,
+    HLOG_DEFAULT_LEVEL, HLOG_DEFAULT_LEVEL, HLOG_DEFAULT_LEVEL, HLOG_DEFAULT_LEVEL,
+};
+
+void HLogSetLevel(int mask, int category)
+{
+    for(int i = 0; i < HLOG_MAX_CATEGORY; i++)
+        if(category < 0 || category == i)
+            g_hlogLevelMask[i].store(mask, std::memory_order_relaxed);
+}
+
+int HLogGetLevel(int category)
+{
+    if(category < 0 || category >= HLOG_MAX_CATEGORY)
+        return 0;
+    return g_hlogLevelMask[category].load(std::memory_order_relaxed);
+}
+
+// parse & apply a level control text, only async-signal-safe things are used
+// here since it's called from the signal handler.
+static int HLogApplyLevelText(const char * p, const char * end)
+{
+    static const struct { const char * name; int flag; } names[] = {
+        {"DEBUG", N_DEBUG}, {"INFO", N_INFO}, {"WARN", N_WARN}, {"ERROR", N_ERROR}, {"FATAL", N_FATAL},
+    };
+    int cnt = 0;
+
+    while(p < end) {
+        const char * eol = p;
+        while(eol < end && *eol != '\n') eol++;
+
+        // up to two tokens: [category] mask
+        const char * tok[2];
+        int tlen[2], ntok = 0;
+        const char * q = p;
+        while(q < eol && *q != '#' && ntok < 2) {
+            while(q < eol && (*q == ' ' || *q == '\t' || *q == '\r')) q++;
+            if(q >= eol || *q == '#') break;
+            tok[ntok] = q;
+            while(q < eol && *q != ' ' && *q != '\t' && *q != '\r' && *q != '#') q++;
+            tlen[ntok] = q - tok[ntok];
+            ntok++;
+        }
+        p = eol + 1;
+        if(ntok == 0) continue;
+
+        int category = -1;
+        const char * m = tok[ntok - 1];
+        const char * mend = m + tlen[ntok - 1];
+        if(ntok == 2 && !(tlen[0] == 1 && tok[0][0] == '*')) {
+            category = 0;
+            for(const char * c = tok[0]; c < tok[0] + tlen[0]; c++) {
+                if(*c < '0' || *c > '9') { category = HLOG_MAX_CATEGORY; break; }
+                category = category * 10 + (*c - '0');
+            }
+            if(category >= HLOG_MAX_CATEGORY) continue;
+        }
+
+        int mask = 0;
+        if(*m >= '0' && *m <= '9') {
+            int base = 10;
+            if(mend - m > 2 && m[0] == '0' && (m[1] == 'x' || m[1] == 'X')) { base = 16; m += 2; }
+            for(; m < mend; m++) {
+                int d = (*m >= '0' && *m <= '9') ? *m - '0' :
+                        (*m >= 'a' && *m <= 'f') ? *m - 'a' + 10 :
+                        (*m >= 'A' && *m <= 'F') ? *m - 'A' + 10 : base;
+                if(d >= base) break;
+                mask = mask * base + d;
+            }
+        } else {
+            while(m < mend) {
+                const char * e = m;
+                while(e < mend && *e != '|' && *e != ',') e++;
+                for(unsigned i = 0; i < sizeof(names)/sizeof(names[0]); i++) {
+                    int k = 0;
+                    while(names[i].name[k] && m + k < e && (m[k] & ~0x20) == names[i].name[k]) k++;
+                    if(names[i].name[k] == 0 && m + k == e) mask |= names[i].flag;
+                }
+                m = e + 1;
+            }
+        }
+
+        HLogSetLevel(mask, category);
+        cnt ++;
+    }
+    return cnt;
+}
+
+static char g_levelFile[512];
+
+int HLogLoadLevelFile(const char * path)
+{
+    char text[4096];
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return -1;
+    int n = read(fd, text, sizeof(text));
+    close(fd);
+    if(n < 0)
+        return -1;
+    return HLogApplyLevelText(text, text + n);
+}
+
+static void HLogLevelSignal(int)
+{
+    int saved = errno;
+    HLogLoadLevelFile(g_levelFile);
+    errno = saved;
+}
+
+int HLogWatchLevelFile(const char * path, int signo)
+{
+    struct sigaction sa;
+
+    snprintf(g_levelFile, sizeof(g_levelFile), "%s", path);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = HLogLevelSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(signo, &sa, NULL))
+        return -1;
+
+    return HLogLoadLevelFile(path);
+}
+
+static struct HLogLevelFromEnv {
+    HLogLevelFromEnv() {
+        const char * path = getenv("HLOG_LEVEL_FILE");
+        if(path) HLogWatchLevelFile(path, SIGUSR1);
+    }
+} g_levelFromEnv;
+
 //#define USE_LOG4CPP
 
+//=====================================================================
+// per-thread cached context, so the header costs a few memcpy:
+//   tid is queried once per thread,
+//   calendar part of the timestamp is recomputed only when the second changes,
+//   file name is already reduced to basename at compile time (HLOG_FILE).
+
+static thread_local pid_t t_tid = 0;
+
+static void HLogResetTid(void)
+{
+    t_tid = 0;
+}
+
+static inline pid_t HLogTid(void)
+{
+    if(t_tid == 0) {
+        static bool atforkRegistered = (pthread_atfork(NULL, NULL, HLogResetTid) == 0);
+        (void)atforkRegistered;
+        t_tid = syscall(SYS_gettid);
+    }
+    return t_tid;
+}
+
+struct HLogTimeCache
+{
+    time_t  sec;
+    int     len;
+    char    text[40];   // "[YYYY-MM-DD hh:mm:ss:"
+};
+static thread_local HLogTimeCache t_timeCache = {-1, 0, {0}};
+
+static inline char * HLogPutDec(char * p, unsigned long v, int width)
+{
+    char tmp[24];
+    int n = 0;
+    do { tmp[n++] = '0' + v % 10; v /= 10; } while(v);
+    while(n < width) tmp[n++] = '0';
+    while(n) *p++ = tmp[--n];
+    return p;
+}
+
+static inline char * HLogPutStr(char * p, const char * s, size_t n)
+{
+    memcpy(p, s, n);
+    return p + n;
+}
+
+static int HLogFormatHeader(char * buffer, int size, int flag, const struct timespec * currentTime,
+                            pid_t tid, const char* file, const char* func, const long line)
+{
+#define HLOG_TAG(col, name) "][tid ", "][" col name COLOR_END "]["
+    static const char * const tags[][2] = {
+        {HLOG_TAG(BLUE,   "DEBUG")},
+        {HLOG_TAG(WHITE,  "INFO")},
+        {HLOG_TAG(YELLOW, "WARN")},
+        {HLOG_TAG(RED,    "ERROR")},
+        {HLOG_TAG(RED,    "FATAL")},
+    };
+#undef HLOG_TAG
+    int t;
+    switch (flag){
+    case N_DEBUG: t = 0; break;
+    case N_INFO:  t = 1; break;
+    case N_WARN:  t = 2; break;
+    case N_ERROR: t = 3; break;
+    case N_FATAL: t = 4; break;
+    default:
+        buffer[0] = 0;
+        return 0;
+    }
+
+    HLogTimeCache & tc = t_timeCache;
+    if(tc.sec != currentTime->tv_sec) {
+        struct tm infoTime;
+        localtime_r(&currentTime->tv_sec, &infoTime); //thread safe.
+        tc.len = snprintf(tc.text, sizeof(tc.text), "[%04d-%02d-%02d %02d:%02d:%02d:",
+                          infoTime.tm_year + 1900, infoTime.tm_mon + 1, infoTime.tm_mday,
+                          infoTime.tm_hour, infoTime.tm_min, infoTime.tm_sec);
+        tc.sec = currentTime->tv_sec;
+    }
+
+    size_t lfile = strlen(file), lfunc = strlen(func);
+    size_t ltag0 = strlen(tags[t][0]), ltag1 = strlen(tags[t][1]);
+    // fixed part: time, fraction, tid, line, separators
+    size_t fixed = tc.len + 4 + ltag0 + 11 + ltag1 + 1 + 1 + 21 + 2 + 1;
+    if(fixed + lfile + lfunc > (size_t)size) {
+        if(fixed + 2 > (size_t)size) { buffer[0] = 0; return 0; }
+        size_t room = size - fixed - 2;
+        if(lfile > room / 2) lfile = room / 2;
+        if(lfunc > room - lfile) lfunc = room - lfile;
+    }
+
+    char * p = buffer;
+    p = HLogPutStr(p, tc.text, tc.len);
+    p = HLogPutDec(p, currentTime->tv_nsec/100000, 4);
+    p = HLogPutStr(p, tags[t][0], ltag0);
+    if(tid < 0) { *p++ = '-'; tid = -tid; }
+    p = HLogPutDec(p, tid, 1);
+    p = HLogPutStr(p, tags[t][1], ltag1);
+    p = HLogPutStr(p, file, lfile);
+    *p++ = ':';
+    p = HLogPutStr(p, func, lfunc);
+    *p++ = ':';
+    if(line < 0) { *p++ = '-'; p = HLogPutDec(p, -line, 1); }
+    else p = HLogPutDec(p, line, 1);
+    *p++ = ']';
+    *p++ = ' ';
+    *p = 0;
+    return p - buffer;
+}
+
+static void HLogShutdown(void);
+
+// at exit, flush the async writer first and then close the file sink
+static void HLogRegisterShutdown(void)
+{
+    static bool registered = false;
+    if(!registered) {
+        atexit(HLogShutdown);
+        registered = true;
+    }
+}
+
+//=====================================================================
+// mmap file sink:
+//   lines are appended into a pre-sized, MAP_SHARED file segment, one
+//   fetch_add reserves room and memcpy writes it, no syscall per line.
+//   the pages belong to the page cache, so everything copied before a crash
+//   is still in the file. segments are rotated by size and/or time, the
+//   retired segment is truncated to its used length.
+
+struct HLogSegment
+{
+    int                     fd;
+    char *                  base;
+    size_t                  size;
+    time_t                  deadline;   // rotate after it (0: never)
+    std::atomic<size_t>     used;       // reserved bytes (may overshoot size)
+    std::atomic<size_t>     written;    // bytes of successful reservations
+    std::atomic<int>        inflight;   // writers currently copying into it
+};
+
+static std::atomic<HLogSegment*>    g_sinkSeg(NULL);
+static std::mutex                   g_sinkLock;
+static std::vector<HLogSegment*>    g_sinkRetired;  // never freed, a late writer may still peek one
+static std::string                  g_sinkPrefix;
+static size_t                       g_sinkSegSize = 0;
+static int                          g_sinkRotateSec = 0;
+static bool                         g_sinkStdout = false;
+static unsigned                     g_sinkSeq = 0;
+
+static HLogSegment * HLogSegmentOpen(void)
+{
+    struct timespec ts;
+    struct tm t;
+    char path[1024];
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    localtime_r(&ts.tv_sec, &t);
+    snprintf(path, sizeof(path), "%s.%04d%02d%02d-%02d%02d%02d.%04u.log", g_sinkPrefix.c_str(),
+             t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, g_sinkSeq++);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        fprintf(stderr, "HLog file sink: cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    // allocate the blocks now, so a full disk fails here instead of SIGBUS later,
+    // only a file system that can't do it at all gets a sparse file
+    int ret = posix_fallocate(fd, 0, g_sinkSegSize);
+    if(ret == EOPNOTSUPP || ret == EINVAL)
+        ret = ftruncate(fd, g_sinkSegSize) != 0 ? errno : 0;
+    if(ret != 0) {
+        fprintf(stderr, "HLog file sink: cannot size %s: %s\n", path, strerror(ret));
+        close(fd);
+        return NULL;
+    }
+    void * base = mmap(NULL, g_sinkSegSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED) {
+        fprintf(stderr, "HLog file sink: mmap %s failed: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    HLogSegment * seg = new HLogSegment;
+    seg->fd = fd;
+    seg->base = (char *)base;
+    seg->size = g_sinkSegSize;
+    seg->deadline = g_sinkRotateSec ? ts.tv_sec + g_sinkRotateSec : 0;
+    seg->used = 0;
+    seg->written = 0;
+    seg->inflight = 0;
+    return seg;
+}
+
+// wait for late writers, then cut the file to what was actually written
+static void HLogSegmentClose(HLogSegment * seg)
+{
+    while(seg->inflight.load())
+        sched_yield();
+
+    size_t len = seg->written.load();
+    munmap(seg->base, seg->size);
+    if(ftruncate(seg->fd, len) != 0)
+        fprintf(stderr, "HLog file sink: truncate failed: %s\n", strerror(errno));
+    close(seg->fd);
+    seg->base = NULL;
+}
+
+// replace the current segment if it's still 'old'
+static void HLogSinkRotate(HLogSegment * old)
+{
+    std::unique_lock<std::mutex> lk(g_sinkLock);
+    if(g_sinkSeg.load() != old)
+        return;
+
+    HLogSegment * seg = HLogSegmentOpen();
+    g_sinkSeg.store(seg);
+    if(old) {
+        HLogSegmentClose(old);
+        g_sinkRetired.push_back(old);
+    }
+}
+
+// return false if the sink is not open (or broken), caller falls back to stdout
+static bool HLogSinkWrite(const char * data, size_t len)
+{
+    for(;;) {
+        HLogSegment * seg = g_sinkSeg.load();
+        if(seg == NULL)
+            return false;
+
+        seg->inflight.fetch_add(1);
+        if(seg != g_sinkSeg.load()) {
+            // rotated meanwhile, don't touch the old mapping
+            seg->inflight.fetch_sub(1);
+            continue;
+        }
+
+        bool expired = false;
+        if(seg->deadline) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+            expired = ts.tv_sec >= seg->deadline;
+        }
+
+        if(!expired && len <= seg->size) {
+            size_t off = seg->used.fetch_add(len, std::memory_order_relaxed);
+            if(off + len <= seg->size) {
+                memcpy(seg->base + off, data, len);
+                seg->written.fetch_add(len, std::memory_order_relaxed);
+                seg->inflight.fetch_sub(1);
+                return true;
+            }
+        }
+        seg->inflight.fetch_sub(1);
+
+        if(len > seg->size)
+            return false;
+        HLogSinkRotate(seg);
+    }
+}
+
+// write formatted text to the file sink and/or stdout
+static void HLogWriteText(const char * data, size_t len)
+{
+    if(!HLogSinkWrite(data, len) || g_sinkStdout)
+        fwrite(data, 1, len, stdout);
+}
+
+int HLogOpenFileSink(const char * prefix, size_t segment_size, int rotate_seconds, bool also_stdout)
+{
+    std::unique_lock<std::mutex> lk(g_sinkLock);
+    if(g_sinkSeg.load())
+        return -1;
+
+    long page = sysconf(_SC_PAGESIZE);
+    if(segment_size < (1<<20)) segment_size = 1<<20;
+    segment_size = (segment_size + page - 1) / page * page;
+
+    g_sinkPrefix = prefix;
+    g_sinkSegSize = segment_size;
+    g_sinkRotateSec = rotate_seconds;
+    g_sinkStdout = also_stdout;
+
+    HLogSegment * seg = HLogSegmentOpen();
+    if(seg == NULL)
+        return -1;
+    g_sinkSeg.store(seg);
+
+    HLogRegisterShutdown();
+    return 0;
+}
+
+void HLogCloseFileSink(void)
+{
+    std::unique_lock<std::mutex> lk(g_sinkLock);
+    HLogSegment * seg = g_sinkSeg.exchange(NULL);
+    if(seg) {
+        HLogSegmentClose(seg);
+        g_sinkRetired.push_back(seg);
+    }
+    // the retired segments stay allocated: a writer may have loaded one just
+    // before it was swapped out, it only bumps inflight & sees it's stale
+}
+
+//=====================================================================
+// async mode:
+//   each logging thread owns a single-producer/single-consumer byte ring,
+//   the caller only formats the user message and copies one binary record
+//   into its own ring (no lock, no syscall), a background thread drains all
+//   rings, formats the header and writes to stdout in big batches.
+//
+//   records from one thread keep their order, records from different
+//   threads are interleaved in drain order (each carries its own timestamp).
+
+struct HLogRecord
+{
+    uint32_t        size;   // bytes occupied in ring (including this header), 8-aligned
+    int             flag;   // 0 means padding up to the end of ring
+    pid_t           tid;
+    uint32_t        len;    // message length (without '\0'), or size of encoded args
+    long            line;
+    struct timespec ts;
+    const char *    file;   // __FILE__/__func__ are string literals, safe to keep pointers
+    const char *    func;
+    const HLogSite* site;   // not NULL for binary records, msg holds encoded args
+    char            msg[0];
+};
+
+struct HLogRing
+{
+    HLogRing(size_t cap):cap(cap), mask(cap - 1), head(0), tail(0), dropped(0), reported(0), busy(false), orphan(false), buf(new char[cap]){}
+    ~HLogRing(){ delete [] buf; }
+
+    const size_t            cap;
+    const size_t            mask;
+    std::atomic<uint64_t>   head;       // written by producer
+    char                    pad[64];    // keep head & tail on different cache lines
+    std::atomic<uint64_t>   tail;       // written by consumer
+    std::atomic<uint64_t>   dropped;    // only grows, see HLogAsyncDropped()
+    uint64_t                reported;   // part of dropped the writer has logged
+    std::atomic<bool>       busy;       // owner is pushing a record, HLogStopAsync() waits for it
+    std::atomic<bool>       orphan;     // owner thread exited, free it after drain
+    char *                  buf;
+};
+
+static std::atomic<int>         g_asyncOn(0);
+static int                      g_asyncPolicy = HLOG_RING_DROP;
+static size_t                   g_asyncRingSize = 1<<20;
+static std::atomic<bool>        g_asyncRunning(false);
+static std::thread              g_asyncThread;
+static std::mutex               g_ringsLock;
+static std::vector<HLogRing*>   g_rings;
+static uint64_t                 g_ringsGoneDropped = 0;     // dropped by freed rings
+
+// binary mode: call sites & the output file
+static std::mutex                   g_sitesLock;
+static std::vector<const HLogSite*> g_sites;
+static FILE *                       g_binFile = NULL;
+static size_t                       g_binSitesWritten = 0;
+
+// the ring may be freed by the writer as soon as it's orphaned, so the holder
+// lets go of it first, and logging from later thread_local destructors of the
+// same thread (t_ringGone, trivially destructible) goes the synchronous way
+static thread_local bool t_ringGone = false;
+
+struct HLogRingHolder
+{
+    HLogRing * ring;
+    HLogRingHolder():ring(NULL){}
+    ~HLogRingHolder()
+    {
+        HLogRing * r = ring;
+        ring = NULL;
+        t_ringGone = true;
+        if(r) r->orphan.store(true, std::memory_order_release);
+    }
+};
+static thread_local HLogRingHolder t_ringHolder;
+
+static HLogRing * HLogThreadRing(void)
+{
+    if(t_ringGone)
+        return NULL;
+    if(t_ringHolder.ring == NULL) {
+        HLogRing * ring = new HLogRing(g_asyncRingSize);
+        std::unique_lock<std::mutex> lk(g_ringsLock);
+        g_rings.push_back(ring);
+        t_ringHolder.ring = ring;
+    }
+    return t_ringHolder.ring;
+}
+
+// reserve room for a record of given payload size in caller's ring,
+// fill the payload and then HLogRingCommit() it.
+// return NULL if ring is full and policy says drop
+static HLogRecord * HLogRingReserve(HLogRing * r, uint32_t len, uint64_t * next_head)
+{
+    size_t need = (sizeof(HLogRecord) + len + 1 + 7) & ~(size_t)7;
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    size_t off, contiguous, total;
+
+    for(int spin = 0;; spin++) {
+        uint64_t tail = r->tail.load(std::memory_order_acquire);
+        off = head & r->mask;
+        contiguous = r->cap - off;
+        total = need + (contiguous < need ? contiguous : 0);
+        if(total <= r->cap - (head - tail))
+            break;
+
+        if(g_asyncPolicy == HLOG_RING_DROP || !g_asyncRunning.load(std::memory_order_relaxed)) {
+            r->dropped.fetch_add(1, std::memory_order_relaxed);
+            return NULL;
+        }
+        if(spin < 64) sched_yield();
+        else usleep(100);
+    }
+
+    if(contiguous < need) {
+        HLogRecord * pad = (HLogRecord *)(r->buf + off);
+        pad->size = contiguous;
+        pad->flag = 0;
+        head += contiguous;
+        off = 0;
+    }
+
+    HLogRecord * rec = (HLogRecord *)(r->buf + off);
+    rec->size = need;
+    rec->len = len;
+    *next_head = head + need;
+    return rec;
+}
+
+static void HLogRingCommit(HLogRing * r, uint64_t next_head)
+{
+    r->head.store(next_head, std::memory_order_release);
+}
+
+// mark caller's ring busy for one push, return NULL if async mode is off
+// (HLogStopAsync() clears g_asyncOn first, then waits for every busy flag,
+// so a record pushed here is always seen by the final drain)
+static HLogRing * HLogRingEnter(void)
+{
+    HLogRing * r = HLogThreadRing();
+    if(r == NULL)
+        return NULL;
+    r->busy.store(true);
+    if(!g_asyncOn.load()) {
+        r->busy.store(false, std::memory_order_release);
+        return NULL;
+    }
+    return r;
+}
+
+static void HLogRingLeave(HLogRing * r)
+{
+    r->busy.store(false, std::memory_order_release);
+}
+
+// return 1 if async mode is off, the caller writes it synchronously
+static int HLogAsyncPush(int flag, const char* file, const char* func, const long line, const char* fmt, va_list args)
+{
+    char msg[4096];
+    struct timespec ts;
+    uint64_t next_head;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    int len = vsnprintf(msg, sizeof(msg), fmt, args);
+    if(len < 0) len = 0;
+    if(len > (int)sizeof(msg) - 1) len = sizeof(msg) - 1;
+
+    HLogRing * r = HLogRingEnter();
+    if(r == NULL)
+        return 1;
+    HLogRecord * rec = HLogRingReserve(r, len, &next_head);
+    if(rec == NULL) {
+        HLogRingLeave(r);
+        return -1;
+    }
+
+    rec->flag = flag;
+    rec->tid = HLogTid();
+    rec->line = line;
+    rec->ts = ts;
+    rec->file = file;
+    rec->func = func;
+    rec->site = NULL;
+    memcpy(rec->msg, msg, len);
+    rec->msg[len] = 0;
+
+    HLogRingCommit(r, next_head);
+    HLogRingLeave(r);
+    return 0;
+}
+
+//=====================================================================
+// binary (deferred formatting) records
+
+// iterate over the tagged args produced by HLogArgWriter
+struct HLogArgReader
+{
+    const char *    p;
+    const char *    end;
+    HLogArgReader(const char * args, int len):p(args), end(args + len){}
+
+    // return tag, or 0 if no more args
+    int next(int64_t & i, double & d, const char * & str, int & slen)
+    {
+        if(p >= end) return 0;
+        int tag = *p++;
+        switch(tag) {
+        case HLOG_ARG_INT:
+        case HLOG_ARG_UINT:
+        case HLOG_ARG_PTR:
+            memcpy(&i, p, 8); p += 8;
+            break;
+        case HLOG_ARG_DOUBLE:
+            memcpy(&d, p, 8); p += 8;
+            break;
+        case HLOG_ARG_STR: {
+            uint16_t n;
+            memcpy(&n, p, 2); p += 2;
+            str = p; slen = n; p += n;
+            break;
+        }
+        default:
+            p = end;
+            return 0;
+        }
+        return tag;
+    }
+};
+
+// render printf-style fmt with the encoded args, the length modifiers in
+// fmt are ignored, the type recorded at call site decides how to print
+int HLogRenderArgs(char * out, int size, const char * fmt, const char * args, int len)
+{
+    HLogArgReader rd(args, len);
+    int n = 0;
+
+#define HLOG_OUT(...) do{ if(n < size) { int _r = snprintf(out + n, size - n, __VA_ARGS__); if(_r > 0) n += _r; } }while(0)
+
+    if(size <= 0) return 0;
+    out[0] = 0;
+
+    while(*fmt && n < size - 1) {
+        if(*fmt != '%') {
+            out[n++] = *fmt++;
+            continue;
+        }
+        if(fmt[1] == '%') {
+            out[n++] = '%';
+            fmt += 2;
+            continue;
+        }
+
+        // %[flags][width][.precision][length]conversion
+        char spec[64];
+        int k = 0;
+        int64_t i; double d; const char * str = NULL; int slen = 0;
+
+        spec[k++] = *fmt++;
+        while(*fmt && strchr("-+ #0'", *fmt) && k < 16) spec[k++] = *fmt++;
+        for(int part = 0; part < 2; part++) {
+            if(part == 1) {
+                if(*fmt != '.') break;
+                spec[k++] = *fmt++;
+            }
+            if(*fmt == '*') {
+                fmt++;
+                int tag = rd.next(i, d, str, slen);
+                k += snprintf(spec + k, sizeof(spec) - k - 8, "%d", (tag == HLOG_ARG_INT || tag == HLOG_ARG_UINT) ? (int)i : 0);
+            }
+            while(*fmt >= '0' && *fmt <= '9' && k < 40) spec[k++] = *fmt++;
+        }
+        while(*fmt && strchr("hlLqjzt", *fmt)) fmt++;
+
+        char conv = *fmt;
+        if(conv == 0) break;
+        fmt++;
+        if(conv == 'n') continue;
+
+        int tag = rd.next(i, d, str, slen);
+        bool is_float = strchr("feEgGaA", conv) != NULL;
+        switch(tag) {
+        case HLOG_ARG_INT:
+        case HLOG_ARG_UINT:
+            if(is_float) {
+                spec[k++] = conv; spec[k] = 0;
+                HLOG_OUT(spec, (double)i);
+            } else if(conv == 'c') {
+                spec[k++] = conv; spec[k] = 0;
+                HLOG_OUT(spec, (int)i);
+            } else {
+                if(!strchr("diouxX", conv)) conv = (tag == HLOG_ARG_INT) ? 'd' : 'u';
+                spec[k++] = 'l'; spec[k++] = 'l'; spec[k++] = conv; spec[k] = 0;
+                if(tag == HLOG_ARG_INT)
+                    HLOG_OUT(spec, (long long)i);
+                else
+                    HLOG_OUT(spec, (unsigned long long)i);
+            }
+            break;
+        case HLOG_ARG_DOUBLE:
+            spec[k++] = is_float ? conv : 'g'; spec[k] = 0;
+            HLOG_OUT(spec, d);
+            break;
+        case HLOG_ARG_STR: {
+            char tmp[4096];
+            if(slen > (int)sizeof(tmp) - 1) slen = sizeof(tmp) - 1;
+            memcpy(tmp, str, slen);
+            tmp[slen] = 0;
+            spec[k++] = 's'; spec[k] = 0;
+            HLOG_OUT(spec, tmp);
+            break;
+        }
+        case HLOG_ARG_PTR:
+            if(conv == 'p') {
+                spec[k++] = 'p'; spec[k] = 0;
+                HLOG_OUT(spec, (void*)(uintptr_t)i);
+            } else {
+                spec[k++] = 'l'; spec[k++] = 'l'; spec[k++] = 'x'; spec[k] = 0;
+                HLOG_OUT(spec, (unsigned long long)i);
+            }
+            break;
+        default:
+            HLOG_OUT("<?>");
+            break;
+        }
+    }
+#undef HLOG_OUT
+
+    if(n > size - 1) n = size - 1;
+    out[n] = 0;
+    return n;
+}
+
+int HLogRegisterSite(HLogSite * site)
+{
+    std::unique_lock<std::mutex> lk(g_sitesLock);
+    if(site->id < 0) {
+        g_sites.push_back(site);
+        __atomic_store_n(&site->id, (int)g_sites.size() - 1, __ATOMIC_RELEASE);
+    }
+    return site->id;
+}
+
+#ifdef USE_LOG4CPP
+static int HLog4cppWrite(int flag, const char* file, const char* func, const long line, const char* msg);
+#endif
+
+int HLogBinaryPush(int flag, const HLogSite * site, const char * args, int len)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    HLogRing * r = g_asyncOn.load(std::memory_order_relaxed) ? HLogRingEnter() : NULL;
+    if(r) {
+        uint64_t next_head;
+        HLogRecord * rec = HLogRingReserve(r, len, &next_head);
+        if(rec == NULL) {
+            HLogRingLeave(r);
+            return -1;
+        }
+
+        rec->flag = flag;
+        rec->tid = HLogTid();
+        rec->line = site->line;
+        rec->ts = ts;
+        rec->file = site->file;
+        rec->func = site->func;
+        rec->site = site;
+        memcpy(rec->msg, args, len);
+
+        HLogRingCommit(r, next_head);
+        HLogRingLeave(r);
+        return 0;
+    }
+
+    // no background writer, render it right now
+#ifdef USE_LOG4CPP
+    if(g_sinkSeg.load(std::memory_order_relaxed) == NULL) {
+        char msg[4096];
+        HLogRenderArgs(msg, sizeof(msg), site->fmt, args, len);
+        return HLog4cppWrite(flag, site->file, site->func, site->line, msg);
+    }
+#endif
+    char buffer[4096 + 1];
+    int offset = HLogFormatHeader(buffer, 4096, flag, &ts, HLogTid(), site->file, site->func, site->line);
+    int n = offset + HLogRenderArgs(buffer + offset, 4096 - offset, site->fmt, args, len);
+    buffer[n++] = '\n';
+    HLogWriteText(buffer, n);
+    return 0;
+}
+
+//=====================================================================
+// background writer
+
+// binary log file layout (native endian):
+//   "HLOGBIN1"
+//   'S' u32 id, i64 line, (u16 len, chars) x 3 for file/func/fmt   -- call site, before its first use
+//   'R' u32 id, i32 flag, i32 tid, i64 sec, i32 nsec, u16 len, args -- one log record
+static const char HLOG_BIN_MAGIC[8] = {'H','L','O','G','B','I','N','1'};
+
+struct HLogBatch
+{
+    char    buf[256*1024];
+    size_t  len;
+    FILE *  fp;
+    HLogBatch(FILE * fp = stdout):len(0), fp(fp){}
+
+    void flush(void)
+    {
+        if(len) {
+            if(fp == stdout)
+                HLogWriteText(buf, len);
+            else
+                fwrite(buf, 1, len, fp);
+        }
+        len = 0;
+    }
+    void reserve(size_t n)
+    {
+        if(len + n > sizeof(buf)) flush();
+    }
+    void put(const void * p, size_t n)
+    {
+        memcpy(buf + len, p, n);
+        len += n;
+    }
+    void put_str(const char * s)
+    {
+        uint16_t n = strnlen(s, 0xFFFF);
+        put(&n, 2);
+        put(s, n);
+    }
+    void append(const HLogRecord * rec)
+    {
+        // header is cut to 512 (long file/func names get shortened), the
+        // message is at most 4096 with its '\0', plus '\n'
+        reserve(512 + 4096 + 1);
+        len += HLogFormatHeader(buf + len, 512, rec->flag, &rec->ts,
+                                rec->tid, rec->file, rec->func, rec->line);
+        if(rec->site)
+            len += HLogRenderArgs(buf + len, 4096, rec->site->fmt, rec->msg, rec->len);
+        else
+            put(rec->msg, rec->len);
+        buf[len++] = '\n';
+    }
+    void append_binary(const HLogRecord * rec)
+    {
+        uint32_t id = rec->site->id;
+        // make sure the decoder knows the call site before its first record
+        if(id >= g_binSitesWritten) {
+            std::unique_lock<std::mutex> lk(g_sitesLock);
+            for(; g_binSitesWritten <= id; g_binSitesWritten++) {
+                const HLogSite * site = g_sites[g_binSitesWritten];
+                uint32_t sid = g_binSitesWritten;
+                int64_t line = site->line;
+                reserve(1 + 4 + 8 + 3*(2 + 0xFFFF));
+                put("S", 1);
+                put(&sid, 4);
+                put(&line, 8);
+                put_str(site->file);
+                put_str(site->func);
+                put_str(site->fmt);
+            }
+        }
+
+        int32_t flag = rec->flag, tid = rec->tid, nsec = rec->ts.tv_nsec;
+        int64_t sec = rec->ts.tv_sec;
+        uint16_t n = rec->len;
+        reserve(1 + 4 + 4 + 4 + 8 + 4 + 2 + n);
+        put("R", 1);
+        put(&id, 4);
+        put(&flag, 4);
+        put(&tid, 4);
+        put(&sec, 8);
+        put(&nsec, 4);
+        put(&n, 2);
+        put(rec->msg, n);
+    }
+};
+
+// return number of records written
+static int HLogAsyncDrain(HLogBatch & batch, HLogBatch * bin)
+{
+    std::vector<HLogRing*> rings;
+    {
+        std::unique_lock<std::mutex> lk(g_ringsLock);
+        rings = g_rings;
+    }
+
+    int cnt = 0;
+    for(size_t i = 0; i < rings.size(); i++) {
+        HLogRing * r = rings[i];
+        bool orphan = r->orphan.load(std::memory_order_acquire);
+        uint64_t tail = r->tail.load(std::memory_order_relaxed);
+        uint64_t head = r->head.load(std::memory_order_acquire);
+
+        while(tail < head) {
+            const HLogRecord * rec = (const HLogRecord *)(r->buf + (tail & r->mask));
+            if(rec->flag) {
+                if(rec->site && bin)
+                    bin->append_binary(rec);
+                else
+                    batch.append(rec);
+                cnt ++;
+            }
+            tail += rec->size;
+        }
+        r->tail.store(tail, std::memory_order_release);
+
+        uint64_t dropped = r->dropped.load(std::memory_order_relaxed) - r->reported;
+        r->reported += dropped;
+        if(dropped) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            batch.reserve(1024);
+            int n = HLogFormatHeader(batch.buf + batch.len, sizeof(batch.buf) - batch.len, N_WARN, &ts,
+                                     HLogTid(), HLOG_FILE, __func__, __LINE__);
+            batch.len += n;
+            batch.len += snprintf(batch.buf + batch.len, sizeof(batch.buf) - batch.len,
+                                  "%llu log records dropped (ring full)\n", (unsigned long long)dropped);
+        }
+
+        if(orphan) {
+            std::unique_lock<std::mutex> lk(g_ringsLock);
+            g_ringsGoneDropped += r->dropped.load(std::memory_order_relaxed);
+            g_rings.erase(std::find(g_rings.begin(), g_rings.end(), r));
+            delete r;
+        }
+    }
+
+    batch.flush();
+    if(bin) bin->flush();
+    if(cnt) {
+        fflush(stdout);
+        if(bin) fflush(bin->fp);
+    }
+    return cnt;
+}
+
+static void HLogAsyncThread(void)
+{
+    HLogBatch * batch = new HLogBatch;
+    HLogBatch * bin = g_binFile ? new HLogBatch(g_binFile) : NULL;
+    while(g_asyncRunning.load(std::memory_order_acquire)) {
+        if(HLogAsyncDrain(*batch, bin) == 0)
+            usleep(1000);
+    }
+    HLogAsyncDrain(*batch, bin);
+    delete batch;
+    delete bin;
+}
+
+int HLogStartAsync(int full_policy, int ring_size)
+{
+    if(g_asyncRunning.load())
+        return -1;
+
+    size_t cap = 4096;
+    while(cap < (size_t)ring_size) cap <<= 1;
+
+    g_asyncPolicy = full_policy;
+    g_asyncRingSize = cap;
+    g_asyncRunning = true;
+    g_asyncThread = std::thread(HLogAsyncThread);
+    g_asyncOn = 1;
+
+    HLogRegisterShutdown();
+    return 0;
+}
+
+void HLogStopAsync(void)
+{
+    if(!g_asyncRunning.load())
+        return;
+
+    // no new pushes, then wait for the ones already past the g_asyncOn check,
+    // the writer keeps draining meanwhile (a blocked producer needs it)
+    g_asyncOn = 0;
+    for(;;) {
+        bool busy = false;
+        {
+            std::unique_lock<std::mutex> lk(g_ringsLock);
+            for(size_t i = 0; i < g_rings.size() && !busy; i++)
+                busy = g_rings[i]->busy.load();
+        }
+        if(!busy) break;
+        sched_yield();
+    }
+    g_asyncRunning = false;
+    g_asyncThread.join();
+
+    if(g_binFile) {
+        fclose(g_binFile);
+        g_binFile = NULL;
+    }
+}
+
+uint64_t HLogAsyncDropped(void)
+{
+    std::unique_lock<std::mutex> lk(g_ringsLock);
+    uint64_t n = g_ringsGoneDropped;
+    for(size_t i = 0; i < g_rings.size(); i++)
+        n += g_rings[i]->dropped.load(std::memory_order_relaxed);
+    return n;
+}
+
+static void HLogShutdown(void)
+{
+    HLogStopAsync();
+    HLogCloseFileSink();
+}
+
+int HLogOpenBinary(const char * path, int full_policy, int ring_size)
+{
+    if(g_asyncRunning.load())
+        return -1;
+
+    FILE * fp = fopen(path, "wb");
+    if(fp == NULL) {
+        fprintf(stderr, "HLogOpenBinary: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fwrite(HLOG_BIN_MAGIC, 1, sizeof(HLOG_BIN_MAGIC), fp);
+
+    g_binFile = fp;
+    g_binSitesWritten = 0;
+    return HLogStartAsync(full_policy, ring_size);
+}
+
+int HLogDecodeBinary(FILE * in, FILE * out)
+{
+    struct DecodedSite {
+        long line;
+        std::string file, func, fmt;
+    };
+    std::vector<DecodedSite> sites;
+    char magic[8];
+    char args[0x10000];
+    char text[8192];
+    int cnt = 0;
+
+#define HLOG_READ(p, n) if(fread(p, 1, n, in) != (size_t)(n)) goto done;
+
+    HLOG_READ(magic, 8);
+    if(memcmp(magic, HLOG_BIN_MAGIC, 8)) {
+        fprintf(stderr, "HLogDecodeBinary: not a binary log\n");
+        return -1;
+    }
+
+    for(;;) {
+        char type;
+        uint32_t id;
+        uint16_t n;
+        HLOG_READ(&type, 1);
+        HLOG_READ(&id, 4);
+
+        if(type == 'S') {
+            // the writer emits sites in id order, anything else is a broken file
+            if(id > sites.size()) {
+                fprintf(stderr, "HLogDecodeBinary: corrupted site id %u\n", id);
+                return -1;
+            }
+            DecodedSite s;
+            int64_t line;
+            HLOG_READ(&line, 8);
+            s.line = line;
+            std::string * strs[3] = {&s.file, &s.func, &s.fmt};
+            for(int k = 0; k < 3; k++) {
+                HLOG_READ(&n, 2);
+                HLOG_READ(args, n);
+                strs[k]->assign(args, n);
+            }
+            if(id == sites.size()) sites.push_back(s);
+            else sites[id] = s;
+        } else if(type == 'R') {
+            int32_t flag, tid, nsec;
+            int64_t sec;
+            HLOG_READ(&flag, 4);
+            HLOG_READ(&tid, 4);
+            HLOG_READ(&sec, 8);
+            HLOG_READ(&nsec, 4);
+            HLOG_READ(&n, 2);
+            HLOG_READ(args, n);
+            if(id >= sites.size()) {
+                fprintf(stderr, "HLogDecodeBinary: unknown call site %u\n", id);
+                return -1;
+            }
+            const DecodedSite & s = sites[id];
+            struct timespec ts;
+            ts.tv_sec = sec;
+            ts.tv_nsec = nsec;
+            int offset = HLogFormatHeader(text, sizeof(text), flag, &ts, tid, s.file.c_str(), s.func.c_str(), s.line);
+            HLogRenderArgs(text + offset, sizeof(text) - offset, s.fmt.c_str(), args, n);
+            fprintf(out, "%s\n", text);
+            cnt ++;
+        } else {
+            fprintf(stderr, "HLogDecodeBinary: corrupted record type 0x%02x\n", (unsigned char)type);
+            return -1;
+        }
+    }
+#undef HLOG_READ
+done:
+    return cnt;
+}
+
+static int HLogNativeInner(int flag, const char* file, const char* func, const long line, const char* fmt, va_list args)
+{
+    if(g_asyncOn.load(std::memory_order_relaxed)) {
+        va_list copy;
+        va_copy(copy, args);
+        int ret = HLogAsyncPush(flag, file, func, line, fmt, copy);
+        va_end(copy);
+        if(ret <= 0)
+            return ret;
+        // async mode stopped meanwhile, write it here
+    }
+
+    struct timespec tp;
+    char buffer[4096 + 1];
+    pid_t tid;
+
+    clock_gettime(CLOCK_REALTIME, &tp);
+    tid = HLogTid();
+
+    int offset = HLogFormatHeader(buffer, sizeof(buffer), flag, &tp, tid, file, func, line);
+    int nMaxLogSize = 4096 - offset - 1;
+    int n = vsnprintf(buffer + offset, nMaxLogSize, fmt, args);
+    n = offset + (n < 0 ? 0 : n < nMaxLogSize ? n : nMaxLogSize - 1);
+    buffer[n++] = '\n';
+    HLogWriteText(buffer, n);
+
+    return 0;
+}
+//=====================================================================
+// log4cpp backend
+
 #ifdef USE_LOG4CPP
 static bool logInitilized = 0;
 
@@ -87,7 +1277,7 @@ int initLog4cpp(std::string configPath)
 }
 
 
-int HLogInner(int flag, const char* file, const char* func, const long line, const char* fmt, ...)
+static int HLog4cppWrite(int flag, const char* file, const char* func, const long line, const char* msg)
 {
     if (!logInitilized) {
         int ret = initLog4cpp("~/.hddlapilog.config");
@@ -101,16 +1291,8 @@ int HLogInner(int flag, const char* file, const char* func, const long line, con
     //printf("log file %s name = %s\n", fn.c_str(), filename.c_str());
     log4cpp::Category& lgrf = log4cpp::Category::getInstance(filename);
 
-    va_list args;
     char buffer[4096] = {0};
-    snprintf(buffer, sizeof(buffer), ":%s:%ld: ", func, line);
-    int offset = strlen(buffer);
-    int nMaxLogSize = 4096 - offset - 1;
-    va_start(args, fmt);
-    vsnprintf(buffer + offset, nMaxLogSize, fmt, args);
-    va_end(args);
-
-    log4cpp::Category::getInstance(filename);
+    snprintf(buffer, sizeof(buffer), ":%s:%ld: %s", func, line, msg);
 
     switch (flag){
     case N_DEBUG:
@@ -136,64 +1318,33 @@ int HLogInner(int flag, const char* file, const char* func, const long line, con
 
     return 0;
 }
-#else
-static int nDebugLevel =  N_DEBUG | N_INFO| N_ERROR | N_FATAL;
+
 int HLogInner(int flag, const char* file, const char* func, const long line, const char* fmt, ...)
 {
-    struct timespec tp;
-    struct tm infoTime;
-    struct timespec* currentTime = &tp;
-
-    clock_gettime(CLOCK_REALTIME, currentTime);
-    localtime_r(&currentTime->tv_sec, &infoTime); //thread safe.
-    long usec = currentTime->tv_nsec/100000;
-    int sec = infoTime.tm_sec;
-    int min = infoTime.tm_min;
-    int hour = infoTime.tm_hour;
-    int month = infoTime.tm_mon;
-    int day   = infoTime.tm_mday;
-    int year  = infoTime.tm_year + 1900;
-
     va_list args;
-    char buffer[4096] = {0};
-    pid_t tid;
-    tid = syscall(SYS_gettid);
-
-    std::string filename = std::string(file);
-    filename = filename.substr(filename.rfind("/") + 1);
-
-    switch (flag & nDebugLevel){
-    case N_DEBUG:
-        snprintf(buffer, sizeof(buffer), "[%04d-%02d-%02d %02d:%02d:%02d:%04ld][tid %d][" BLUE "DEBUG" COLOR_END "][%s:%s:%ld] ", year, month, day, hour, min, sec, usec, tid, filename.c_str(), func, line);
-        break;
-
-    case N_INFO:
-        snprintf(buffer, sizeof(buffer), "[%04d-%02d-%02d %02d:%02d:%02d:%04ld][tid %d][" WHITE "INFO" COLOR_END "][%s:%s:%ld] ", year, month, day, hour, min, sec, usec, tid, filename.c_str(), func, line);
-        break;
 
-    case N_WARN:
-        snprintf(buffer, sizeof(buffer), "[%04d-%02d-%02d %02d:%02d:%02d:%04ld][tid %d][" YELLOW "WARN" COLOR_END "][%s:%s:%ld] ", year, month, day, hour, min, sec, usec, tid, filename.c_str(), func, line);
-        break;
-
-    case N_ERROR:
-        snprintf(buffer, sizeof(buffer), "[%04d-%02d-%02d %02d:%02d:%02d:%04ld][tid %d][" RED "ERROR" COLOR_END "][%s:%s:%ld] ", year, month, day, hour, min, sec, usec, tid, filename.c_str(), func, line);
-        break;
-
-    case N_FATAL:
-        snprintf(buffer, sizeof(buffer), "[%04d-%02d-%02d %02d:%02d:%02d:%04ld][tid %d][" RED "FATAL" COLOR_END "][%s:%s:%ld] ", year, month, day, hour, min, sec, usec, tid, filename.c_str(), func, line);
-        break;
-    }
-
-    if(flag & nDebugLevel) {
-        int offset = strlen(buffer);
-        int nMaxLogSize = 4096 - offset - 1;
+    // async mode & the file sink replace log4cpp while they are on
+    if(g_asyncOn.load(std::memory_order_relaxed) || g_sinkSeg.load(std::memory_order_relaxed)) {
         va_start(args, fmt);
-        vsnprintf(buffer + offset, nMaxLogSize, fmt, args);
+        int ret = HLogNativeInner(flag, file, func, line, fmt, args);
         va_end(args);
-        fprintf(stdout, "%s\n", buffer);
+        return ret;
     }
 
-    return 0;
+    char msg[4096];
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    return HLog4cppWrite(flag, file, func, line, msg);
+}
+#else
+int HLogInner(int flag, const char* file, const char* func, const long line, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int ret = HLogNativeInner(flag, file, func, line, fmt, args);
+    va_end(args);
+    return ret;
 }
 #endif
 
@@ -2,6 +2,12 @@
 #define __HDDL_UTILS_HDDL_HLOG_H__
 
 #include <string>
+#include <atomic>
+#include <type_traits>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
 
 typedef enum {
     N_DEBUG = 0x01,
@@ -12,20 +18,197 @@ typedef enum {
     N_FATAL = 0x80
 } HLogLevel;
 
-#define HDebug(...) HLogInner(N_DEBUG, __FILE__, __func__, __LINE__, __VA_ARGS__);
+// compile-time minimum level, log calls below it are removed entirely
+#ifndef HLOG_MIN_LEVEL
+#define HLOG_MIN_LEVEL N_DEBUG
+#endif
+
+// category of the log calls in a translation unit (0 ~ HLOG_MAX_CATEGORY-1),
+// define it before including HLog.h to get a separately switchable level mask
+#ifndef HLOG_CATEGORY
+#define HLOG_CATEGORY 0
+#endif
+#define HLOG_MAX_CATEGORY 16
+
+// runtime level mask of each category, checked before any argument is evaluated
+extern std::atomic<int> g_hlogLevelMask[HLOG_MAX_CATEGORY];
+
+#define HLOG_ENABLED(flag) \
+    ((flag) >= HLOG_MIN_LEVEL && (g_hlogLevelMask[HLOG_CATEGORY].load(std::memory_order_relaxed) & (flag)))
+
+// basename of a source path, evaluated at compile time
+constexpr const char * HLogBasename(const char * p, const char * last)
+{
+    return *p == 0 ? last : HLogBasename(p + 1, *p == '/' ? p + 1 : last);
+}
+constexpr const char * HLogBasename(const char * path)
+{
+    return HLogBasename(path, path);
+}
+#define HLOG_FILE HLogBasename(__FILE__)
+
+#ifdef HLOG_BINARY
+// binary mode: every call site is registered once, then each call only
+// records the site id, a timestamp and the raw arguments, formatting is
+// deferred to the background writer or to the offline decoder (hlogdecode).
+// the format must be a string literal.
+#define HLOG_CALL(flag, fmt, ...) do { if(HLOG_ENABLED(flag)) { \
+        static HLogSite _hlog_site = {HLOG_FILE, __func__, __LINE__, fmt, -1}; \
+        HLogBinary(flag, &_hlog_site, ##__VA_ARGS__); \
+    } } while(0)
+#else
+#define HLOG_CALL(flag, ...) do { if(HLOG_ENABLED(flag)) { \
+        static constexpr const char * _hlog_file = HLOG_FILE; \
+        HLogInner(flag, _hlog_file, __func__, __LINE__, __VA_ARGS__); \
+    } } while(0)
+#endif
 
-#define HInfo(...) HLogInner(N_INFO, __FILE__, __func__, __LINE__, __VA_ARGS__);
+#define HDebug(...) HLOG_CALL(N_DEBUG, __VA_ARGS__);
 
-#define HWarn(...) HLogInner(N_WARN, __FILE__, __func__, __LINE__, __VA_ARGS__);
+#define HInfo(...) HLOG_CALL(N_INFO, __VA_ARGS__);
 
-#define HError(...) HLogInner(N_ERROR, __FILE__, __func__, __LINE__, __VA_ARGS__);
+#define HWarn(...) HLOG_CALL(N_WARN, __VA_ARGS__);
 
-#define HFatal(...) HLogInner(N_FATAL, __FILE__, __func__, __LINE__, __VA_ARGS__);
+#define HError(...) HLOG_CALL(N_ERROR, __VA_ARGS__);
 
-#define HLog(flag, ...) HLogInner(flag, __FILE__, __func__, __LINE__, __VA_ARGS__);
+#define HFatal(...) HLOG_CALL(N_FATAL, __VA_ARGS__);
+
+#define HLog(flag, ...) HLOG_CALL(flag, __VA_ARGS__);
 
 int HLogInner(int flag, const char* file, const char* func, const long line, const char* fmt, ...);
 
+// async mode: HLog* calls only push a binary record into a per-thread
+// lock-free ring, a background thread formats & writes them in batches.
+typedef enum {
+    HLOG_RING_DROP = 0,     // drop the record (counted & reported) when ring is full
+    HLOG_RING_BLOCK = 1     // wait for background thread to make room
+} HLogRingFullPolicy;
+
+int HLogStartAsync(int full_policy = HLOG_RING_DROP, int ring_size = 1<<20);
+void HLogStopAsync(void);     // flush all pending records & stop background thread
+uint64_t HLogAsyncDropped(void);  // records dropped on full rings so far, all threads
+
+// native file sink: log lines are appended into pre-sized mmap'd segments
+//     <prefix>.<YYYYmmdd-HHMMSS>.<seq>.log
+// rotated when segment_size is used up or rotate_seconds passed (0: by size only).
+// lines written before a crash are kept (they live in the page cache), but the
+// segment keeps its full pre-sized length: the unused tail, and the hole of a
+// line that was being copied at the crash, are NUL bytes, which no log line
+// contains. readers drop them (tr -d '\0'). closed/rotated segments are cut to
+// their length. with USE_LOG4CPP, lines go here instead of log4cpp while open.
+int HLogOpenFileSink(const char * prefix, size_t segment_size = 64<<20, int rotate_seconds = 0, bool also_stdout = false);
+void HLogCloseFileSink(void);
+
+// runtime level control, category -1 means all categories
+void HLogSetLevel(int mask, int category = -1);
+int HLogGetLevel(int category = 0);
+
+// load level masks from a control file, each line is
+//     [category|*] mask
+// mask is a number (0xC7) or level names (DEBUG|INFO|ERROR), '#' starts a comment.
+// HLogWatchLevelFile() loads it now and again whenever signo is received,
+// (it's also installed at startup if env HLOG_LEVEL_FILE is set)
+int HLogLoadLevelFile(const char * path);
+int HLogWatchLevelFile(const char * path, int signo = SIGUSR1);
+
+// binary mode: records are written to a binary file by the background writer,
+// use HLogDecodeBinary() (hlogdecode tool) to render them into text.
+// without it, binary records are rendered to stdout like the text mode
+int HLogOpenBinary(const char * path, int full_policy = HLOG_RING_DROP, int ring_size = 1<<20);
+int HLogDecodeBinary(FILE * in, FILE * out);
+
+//=====================================================================
+// binary mode internals
+
+struct HLogSite
+{
+    const char *    file;
+    const char *    func;
+    long            line;
+    const char *    fmt;
+    int             id;     // -1 until registered
+};
+
+// argument tags in a binary record
+enum {
+    HLOG_ARG_INT = 'i',     // int64
+    HLOG_ARG_UINT = 'u',    // uint64
+    HLOG_ARG_DOUBLE = 'd',  // double
+    HLOG_ARG_STR = 's',     // u16 length + chars
+    HLOG_ARG_PTR = 'p'      // uint64
+};
+
+struct HLogArgWriter
+{
+    char    buf[1024];
+    int     len;
+    HLogArgWriter():len(0){}
+
+    void put(char tag, const void * p, int n)
+    {
+        if(len + 1 + n > (int)sizeof(buf)) return;
+        buf[len++] = tag;
+        memcpy(buf + len, p, n);
+        len += n;
+    }
+    void put_str(const char * s, size_t n)
+    {
+        if(len + 3 > (int)sizeof(buf)) return;
+        if(n > sizeof(buf) - len - 3) n = sizeof(buf) - len - 3;
+        uint16_t n16 = n;
+        buf[len++] = HLOG_ARG_STR;
+        memcpy(buf + len, &n16, 2);
+        memcpy(buf + len + 2, s, n);
+        len += 2 + n;
+    }
+};
+
+template<class T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+HLogEncodeArg(HLogArgWriter & w, T v) { int64_t x = v; w.put(HLOG_ARG_INT, &x, 8); }
+
+template<class T>
+inline typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+HLogEncodeArg(HLogArgWriter & w, T v) { uint64_t x = v; w.put(HLOG_ARG_UINT, &x, 8); }
+
+template<class T>
+inline typename std::enable_if<std::is_enum<T>::value>::type
+HLogEncodeArg(HLogArgWriter & w, T v) { int64_t x = (int64_t)v; w.put(HLOG_ARG_INT, &x, 8); }
+
+template<class T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+HLogEncodeArg(HLogArgWriter & w, T v) { double x = v; w.put(HLOG_ARG_DOUBLE, &x, 8); }
+
+template<class T>
+inline void HLogEncodeArg(HLogArgWriter & w, const T * p) { uint64_t x = (uintptr_t)p; w.put(HLOG_ARG_PTR, &x, 8); }
+
+inline void HLogEncodeArg(HLogArgWriter & w, const char * s) { if(!s) s = "(null)"; w.put_str(s, strlen(s)); }
+inline void HLogEncodeArg(HLogArgWriter & w, char * s) { HLogEncodeArg(w, (const char *)s); }
+inline void HLogEncodeArg(HLogArgWriter & w, const std::string & s) { w.put_str(s.data(), s.size()); }
+
+inline void HLogEncodeArgs(HLogArgWriter &) {}
+template<class T, class... Rest>
+inline void HLogEncodeArgs(HLogArgWriter & w, const T & v, const Rest &... rest)
+{
+    HLogEncodeArg(w, v);
+    HLogEncodeArgs(w, rest...);
+}
+
+int HLogRegisterSite(HLogSite * site);
+int HLogBinaryPush(int flag, const HLogSite * site, const char * args, int len);
+int HLogRenderArgs(char * out, int size, const char * fmt, const char * args, int len);
+
+template<class... Args>
+inline int HLogBinary(int flag, HLogSite * site, const Args &... args)
+{
+    if(__atomic_load_n(&site->id, __ATOMIC_ACQUIRE) < 0)
+        HLogRegisterSite(site);
+
+    HLogArgWriter w;
+    HLogEncodeArgs(w, args...);
+    return HLogBinaryPush(flag, site, w.buf, w.len);
+}
+
 int initLog4cpp(std::string configPath);
 
 std::string getEnvVar(const char* var);
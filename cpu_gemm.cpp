@@ -0,0 +1,778 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <immintrin.h>
+
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <functional>
+
+#include "thread_pool.h"
+
+#include "cpu_gemm.h"
+
+/***************************************************************************
+ Goto/BLIS style blocking, column-major:
+
+    for jc in N step NC:                      B panel  KC*NC  ~ L3
+      for pc in K step KC:
+        pack B[pc:pc+KC, jc:jc+NC]  -> Bp      (NR wide micro-panels)
+        for ic in M step MC:                  A block  MC*KC  ~ L2
+          pack A[ic:ic+MC, pc:pc+KC] -> Ap     (MR tall micro-panels)
+          for jr in NC step NR:               B micro-panel KC*NR ~ L1
+            for ir in MC step MR:
+              C[ir:ir+MR, jr:jr+NR] += Ap(ir) * Bp(jr)   (micro-kernel, in registers)
+
+ multi-thread: C is cut into a mt x nt grid of MR/NR aligned blocks, one per
+ thread, each thread runs the loops above on its block with its own packed
+ buffers. grid shape minimizes per-thread M/mt + N/nt, i.e. the panels each
+ thread has to pack.
+
+ micro-kernel: a column of C tile (MR floats) is one or two SIMD registers,
+ each k step loads MR floats of A, broadcasts NR floats of B and issues
+ MR/W * NR FMAs.
+********************************************************/
+
+typedef void (*sgemm_ukernel_t)(int kc, const float *Ap, const float *Bp,
+                                float *C, int ldc, int accumulate);
+
+struct sgemm_kernel
+{
+    const char *    name;
+    int             mr;
+    int             nr;
+    sgemm_ukernel_t ukernel;
+};
+
+//=====================================================================
+// micro-kernels
+
+static void sgemm_ukernel_scalar(int kc, const float *Ap, const float *Bp,
+                                 float *C, int ldc, int accumulate)
+{
+    enum { MR = 4, NR = 4 };
+    float acc[NR][MR] = {{0}};
+
+    for (int k = 0; k < kc; k++) {
+        for (int j = 0; j < NR; j++)
+            for (int i = 0; i < MR; i++)
+                acc[j][i] += Ap[i] * Bp[j];
+        Ap += MR;
+        Bp += NR;
+    }
+
+    for (int j = 0; j < NR; j++)
+        for (int i = 0; i < MR; i++)
+            C[j*ldc + i] = accumulate ? C[j*ldc + i] + acc[j][i] : acc[j][i];
+}
+
+__attribute__((target("avx2,fma")))
+static void sgemm_ukernel_avx2(int kc, const float *Ap, const float *Bp,
+                               float *C, int ldc, int accumulate)
+{
+    // 16x6 tile: 12 accumulators + 2 A + 1 broadcast out of 16 ymm
+    enum { MR = 16, NR = 6 };
+    __m256 c[NR][2];
+
+    for (int j = 0; j < NR; j++)
+        c[j][0] = c[j][1] = _mm256_setzero_ps();
+
+    for (int k = 0; k < kc; k++) {
+        __m256 a0 = _mm256_load_ps(Ap);
+        __m256 a1 = _mm256_load_ps(Ap + 8);
+        for (int j = 0; j < NR; j++) {
+            __m256 b = _mm256_broadcast_ss(Bp + j);
+            c[j][0] = _mm256_fmadd_ps(a0, b, c[j][0]);
+            c[j][1] = _mm256_fmadd_ps(a1, b, c[j][1]);
+        }
+        Ap += MR;
+        Bp += NR;
+    }
+
+    for (int j = 0; j < NR; j++) {
+        float *cj = C + j*ldc;
+        if (accumulate) {
+            c[j][0] = _mm256_add_ps(c[j][0], _mm256_loadu_ps(cj));
+            c[j][1] = _mm256_add_ps(c[j][1], _mm256_loadu_ps(cj + 8));
+        }
+        _mm256_storeu_ps(cj, c[j][0]);
+        _mm256_storeu_ps(cj + 8, c[j][1]);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void sgemm_ukernel_avx512(int kc, const float *Ap, const float *Bp,
+                                 float *C, int ldc, int accumulate)
+{
+    // 32x12 tile: 24 accumulators + 2 A + 1 broadcast out of 32 zmm
+    enum { MR = 32, NR = 12 };
+    __m512 c[NR][2];
+
+    for (int j = 0; j < NR; j++)
+        c[j][0] = c[j][1] = _mm512_setzero_ps();
+
+    for (int k = 0; k < kc; k++) {
+        __m512 a0 = _mm512_load_ps(Ap);
+        __m512 a1 = _mm512_load_ps(Ap + 16);
+        _mm_prefetch((const char *)(Ap + 8*MR), _MM_HINT_T0);
+        for (int j = 0; j < NR; j++) {
+            __m512 b = _mm512_set1_ps(Bp[j]);
+            c[j][0] = _mm512_fmadd_ps(a0, b, c[j][0]);
+            c[j][1] = _mm512_fmadd_ps(a1, b, c[j][1]);
+        }
+        Ap += MR;
+        Bp += NR;
+    }
+
+    for (int j = 0; j < NR; j++) {
+        float *cj = C + j*ldc;
+        if (accumulate) {
+            c[j][0] = _mm512_add_ps(c[j][0], _mm512_loadu_ps(cj));
+            c[j][1] = _mm512_add_ps(c[j][1], _mm512_loadu_ps(cj + 16));
+        }
+        _mm512_storeu_ps(cj, c[j][0]);
+        _mm512_storeu_ps(cj + 16, c[j][1]);
+    }
+}
+
+static const sgemm_kernel kernels[] = {
+    {"avx512", 32, 12, sgemm_ukernel_avx512},
+    {"avx2",   16,  6, sgemm_ukernel_avx2},
+    {"scalar",  4,  4, sgemm_ukernel_scalar},
+};
+
+static const sgemm_kernel * select_kernel(void)
+{
+    const char * force = getenv("CPU_GEMM_KERNEL");
+    if (force) {
+        for (unsigned i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++)
+            if (strcmp(force, kernels[i].name) == 0)
+                return &kernels[i];
+        fprintf(stderr, "CPU_GEMM_KERNEL=%s is unknown, auto-select\n", force);
+    }
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return &kernels[0];
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return &kernels[1];
+    return &kernels[2];
+}
+
+//=====================================================================
+// block sizes
+
+struct sgemm_blocking
+{
+    int kc, mc, nc;
+};
+
+static long cache_size(int name, long fallback)
+{
+    long sz = sysconf(name);
+    return sz > 0 ? sz : fallback;
+}
+
+static sgemm_blocking select_blocking(const sgemm_kernel * kern)
+{
+    long l1 = cache_size(_SC_LEVEL1_DCACHE_SIZE, 32 << 10);
+    long l2 = cache_size(_SC_LEVEL2_CACHE_SIZE, 256 << 10);
+    long l3 = cache_size(_SC_LEVEL3_CACHE_SIZE, 8 << 20);
+    sgemm_blocking b;
+
+    // B micro-panel (KC*NR) takes about half of L1, the rest for A & C streams
+    b.kc = (int)(l1 / 2 / (kern->nr * sizeof(float)));
+    b.kc = b.kc < 64 ? 64 : b.kc > 1024 ? 1024 : b.kc & ~7;
+
+    // A block (MC*KC) takes about half of L2
+    b.mc = (int)(l2 / 2 / (b.kc * sizeof(float)));
+    b.mc = (b.mc / kern->mr) * kern->mr;
+    if (b.mc < kern->mr) b.mc = kern->mr;
+
+    // B panel (KC*NC) takes about half of L3
+    b.nc = (int)(l3 / 2 / (b.kc * sizeof(float)));
+    b.nc = (b.nc / kern->nr) * kern->nr;
+    if (b.nc < kern->nr) b.nc = kern->nr;
+    if (b.nc > 8192) b.nc = 8192 / kern->nr * kern->nr;
+    return b;
+}
+
+//=====================================================================
+// packing, zero padded up to MR/NR so micro-kernels never see edges.
+// 16-bit storage formats are widened to fp32 here
+
+static inline float to_float(float v)    { return v; }
+static inline float to_float(cpu_bf16 v) { return cpu_bf16_to_float(v); }
+static inline float to_float(cpu_fp16 v) { return cpu_fp16_to_float(v); }
+
+template<class T>
+static void pack_A(int mc, int kc, const T *A, int lda, float *Ap, int mr)
+{
+    for (int ir = 0; ir < mc; ir += mr) {
+        int m = mc - ir < mr ? mc - ir : mr;
+        for (int k = 0; k < kc; k++) {
+            const T *a = A + (size_t)k*lda + ir;
+            int i = 0;
+            for (; i < m; i++) Ap[i] = to_float(a[i]);
+            for (; i < mr; i++) Ap[i] = 0.0f;
+            Ap += mr;
+        }
+    }
+}
+
+template<class T>
+static void pack_B(int kc, int nc, const T *B, int ldb, float *Bp, int nr)
+{
+    for (int jr = 0; jr < nc; jr += nr) {
+        int n = nc - jr < nr ? nc - jr : nr;
+        for (int k = 0; k < kc; k++) {
+            const T *b = B + (size_t)jr*ldb + k;
+            int j = 0;
+            for (; j < n; j++) Bp[j] = to_float(b[(size_t)j*ldb]);
+            for (; j < nr; j++) Bp[j] = 0.0f;
+            Bp += nr;
+        }
+    }
+}
+
+template<class T>
+static T * grow_buffer(T *&buf, size_t &cap, size_t need)
+{
+    if (need > cap) {
+        free(buf);
+        buf = NULL;
+        if (posix_memalign((void **)&buf, 64, need * sizeof(T)))
+            return NULL;
+        cap = need;
+    }
+    return buf;
+}
+
+//=====================================================================
+// driver
+
+static void sgemm_macro_kernel(const sgemm_kernel * kern, int mc, int nc, int kc,
+                               const float *Ap, const float *Bp,
+                               float *C, int ldc, int accumulate)
+{
+    const int mr = kern->mr, nr = kern->nr;
+    float edge[32*12] __attribute__((aligned(64)));
+
+    for (int jr = 0; jr < nc; jr += nr) {
+        int n = nc - jr < nr ? nc - jr : nr;
+        for (int ir = 0; ir < mc; ir += mr) {
+            int m = mc - ir < mr ? mc - ir : mr;
+            float *c = C + jr*ldc + ir;
+            const float *a = Ap + ir*kc;
+            const float *b = Bp + jr*kc;
+
+            if (m == mr && n == nr) {
+                kern->ukernel(kc, a, b, c, ldc, accumulate);
+                continue;
+            }
+
+            // partial tile, go through a full-size scratch tile
+            if (accumulate)
+                for (int j = 0; j < n; j++)
+                    memcpy(edge + j*mr, c + j*ldc, m * sizeof(float));
+            kern->ukernel(kc, a, b, edge, mr, accumulate);
+            for (int j = 0; j < n; j++)
+                memcpy(c + j*ldc, edge + j*mr, m * sizeof(float));
+        }
+    }
+}
+
+static const sgemm_kernel * the_kernel(void)
+{
+    static const sgemm_kernel * kern = select_kernel();
+    return kern;
+}
+
+const char * cpu_sgemm_kernel_name(void)
+{
+    return the_kernel()->name;
+}
+
+template<class T>
+static void sgemm_serial(const sgemm_kernel * kern, const sgemm_blocking & blk,
+                         int M, int N, int K,
+                         const T *A, int lda,
+                         const T *B, int ldb,
+                         float *C, int ldc)
+{
+    // packed buffers are kept per thread and reused across calls, they are
+    // allocated & first touched by the thread using them, so the pages land
+    // on its local NUMA node
+    static thread_local float * Ap = NULL;
+    static thread_local float * Bp = NULL;
+    static thread_local size_t Ap_cap = 0, Bp_cap = 0;
+
+    if (!grow_buffer(Ap, Ap_cap, (size_t)blk.mc * blk.kc) ||
+        !grow_buffer(Bp, Bp_cap, (size_t)blk.nc * blk.kc)) {
+        fprintf(stderr, "cpu_sgemm: out of memory\n");
+        return;
+    }
+
+    for (int jc = 0; jc < N; jc += blk.nc) {
+        int nc = N - jc < blk.nc ? N - jc : blk.nc;
+        for (int pc = 0; pc < K; pc += blk.kc) {
+            int kc = K - pc < blk.kc ? K - pc : blk.kc;
+            pack_B(kc, nc, B + (size_t)jc*ldb + pc, ldb, Bp, kern->nr);
+            for (int ic = 0; ic < M; ic += blk.mc) {
+                int mc = M - ic < blk.mc ? M - ic : blk.mc;
+                pack_A(mc, kc, A + (size_t)pc*lda + ic, lda, Ap, kern->mr);
+                sgemm_macro_kernel(kern, mc, nc, kc, Ap, Bp,
+                                   C + (size_t)jc*ldc + ic, ldc, pc > 0);
+            }
+        }
+    }
+}
+
+//=====================================================================
+// threading
+
+static int g_nthreads = 0;                  // 0: not decided yet
+static ThreadPool * g_pool = NULL;
+static int g_pool_size = 0;
+static std::mutex g_pool_lock;
+static std::atomic<int> g_next_cpu(0);
+
+static int default_threads(void)
+{
+    const char * env = getenv("CPU_GEMM_THREADS");
+    int n = env ? atoi(env) : 0;
+    if (n <= 0) n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+void cpu_sgemm_set_threads(int nthreads)
+{
+    std::unique_lock<std::mutex> lk(g_pool_lock);
+    g_nthreads = nthreads > 0 ? nthreads : default_threads();
+}
+
+int cpu_sgemm_get_threads(void)
+{
+    std::unique_lock<std::mutex> lk(g_pool_lock);
+    if (g_nthreads == 0) g_nthreads = default_threads();
+    return g_nthreads;
+}
+
+// CPU_GEMM_AFFINITY=1 pins each thread (caller included) to its own core on
+// first use, so it stays next to the packed buffers it touched
+static void pin_this_thread(void)
+{
+    static const bool enabled = getenv("CPU_GEMM_AFFINITY") && atoi(getenv("CPU_GEMM_AFFINITY"));
+    static thread_local bool pinned = false;
+    if (!enabled || pinned)
+        return;
+    pinned = true;
+
+    int ncpu = std::thread::hardware_concurrency();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(g_next_cpu.fetch_add(1) % (ncpu > 0 ? ncpu : 1), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// pool has nthreads-1 workers, the calling thread does one share itself
+static ThreadPool * get_pool(int nthreads)
+{
+    std::unique_lock<std::mutex> lk(g_pool_lock);
+    if (g_pool_size != nthreads) {
+        delete g_pool;
+        g_pool = new ThreadPool(nthreads - 1, 0x7FFFFFFF);
+        g_pool_size = nthreads;
+    }
+    return g_pool;
+}
+
+static void split_grid(int M, int N, int nthreads, int &mt, int &nt)
+{
+    double best = -1;
+    for (int f = 1; f <= nthreads; f++) {
+        if (nthreads % f) continue;
+        double cost = (double)M / f + (double)N / (nthreads / f);
+        if (best < 0 || cost < best) {
+            best = cost;
+            mt = f;
+            nt = nthreads / f;
+        }
+    }
+}
+
+// [begin, end) of part i out of n, aligned to unit
+static void split_range(int total, int n, int i, int unit, int &begin, int &end)
+{
+    int units = (total + unit - 1) / unit;
+    begin = (int)((long)units * i / n) * unit;
+    end = (int)((long)units * (i + 1) / n) * unit;
+    if (end > total) end = total;
+    if (begin > total) begin = total;
+}
+
+// run part(m0, m1, n0, n1) over a 2D split of C, MR/NR aligned
+static void gemm_parallel(int M, int N, int K, int mr, int nr,
+                          const std::function<void(int, int, int, int)> & part)
+{
+    int pool_threads = cpu_sgemm_get_threads();
+    int nthreads = pool_threads;
+
+    // not worth waking up other cores for tiny problems
+    if ((double)M * N * K < 64.0 * 64 * 64 * nthreads)
+        nthreads = 1;
+    if (nthreads > 1) {
+        int max_tiles = ((M + mr - 1) / mr) * ((N + nr - 1) / nr);
+        if (nthreads > max_tiles) nthreads = max_tiles;
+    }
+
+    if (nthreads == 1) {
+        pin_this_thread();
+        part(0, M, 0, N);
+        return;
+    }
+
+    int mt = 1, nt = 1;
+    split_grid(M, N, nthreads, mt, nt);
+
+    auto share = [&](int t) {
+        int m0, m1, n0, n1;
+        split_range(M, mt, t % mt, mr, m0, m1);
+        split_range(N, nt, t / mt, nr, n0, n1);
+        pin_this_thread();
+        if (m1 > m0 && n1 > n0)
+            part(m0, m1, n0, n1);
+    };
+
+    ThreadPool * pool = get_pool(pool_threads);
+    std::vector<std::future<void>> done;
+    for (int t = 1; t < nthreads; t++)
+        done.push_back(pool->enqueue(share, t));
+    share(0);
+    for (auto & f : done)
+        f.get();
+}
+
+template<class T>
+static void gemm_f32acc(int M, int N, int K,
+                        const T *A, int lda,
+                        const T *B, int ldb,
+                        float *C, int ldc)
+{
+    const sgemm_kernel * kern = the_kernel();
+    static const sgemm_blocking blk = select_blocking(kern);
+
+    if (M <= 0 || N <= 0)
+        return;
+    if (K <= 0) {
+        for (int n = 0; n < N; n++)
+            memset(C + (size_t)n*ldc, 0, M * sizeof(float));
+        return;
+    }
+
+    gemm_parallel(M, N, K, kern->mr, kern->nr, [&](int m0, int m1, int n0, int n1) {
+        sgemm_serial(kern, blk, m1 - m0, n1 - n0, K,
+                     A + m0, lda, B + (size_t)n0*ldb, ldb,
+                     C + (size_t)n0*ldc + m0, ldc);
+    });
+}
+
+void cpu_sgemm(int M, int N, int K,
+               const float *A, int lda,
+               const float *B, int ldb,
+               float *C, int ldc)
+{
+    gemm_f32acc(M, N, K, A, lda, B, ldb, C, ldc);
+}
+
+double cpu_sgemm_peak_gflops(void)
+{
+    // micro-kernel alone on L1 resident panels, every thread of the pool
+    enum { KC = 128, ITERS = 20000 };
+    const sgemm_kernel * kern = the_kernel();
+    int nthreads = cpu_sgemm_get_threads();
+
+    auto spin = [kern](int) {
+        float Ap[32*KC] __attribute__((aligned(64)));
+        float Bp[12*KC] __attribute__((aligned(64)));
+        float C[32*12] __attribute__((aligned(64)));
+        for (int i = 0; i < 32*KC; i++) Ap[i] = 1e-3f;
+        for (int i = 0; i < 12*KC; i++) Bp[i] = 1e-3f;
+        memset(C, 0, sizeof(C));
+        pin_this_thread();
+        for (int i = 0; i < ITERS; i++)
+            kern->ukernel(KC, Ap, Bp, C, kern->mr, 1);
+        // keep the result alive
+        volatile float sink = C[0];
+        (void)sink;
+    };
+
+    double best = 0;
+    for (int rep = 0; rep < 3; rep++) {
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<std::future<void>> done;
+        for (int t = 1; t < nthreads; t++)
+            done.push_back(get_pool(nthreads)->enqueue(spin, t));
+        spin(0);
+        for (auto & f : done)
+            f.get();
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        double gflops = 2.0 * kern->mr * kern->nr * KC * ITERS * nthreads / sec * 1e-9;
+        if (gflops > best) best = gflops;
+    }
+    return best;
+}
+
+void cpu_gemm_bf16(int M, int N, int K,
+                   const cpu_bf16 *A, int lda,
+                   const cpu_bf16 *B, int ldb,
+                   float *C, int ldc)
+{
+    gemm_f32acc(M, N, K, A, lda, B, ldb, C, ldc);
+}
+
+void cpu_gemm_fp16(int M, int N, int K,
+                   const cpu_fp16 *A, int lda,
+                   const cpu_fp16 *B, int ldb,
+                   float *C, int ldc)
+{
+    gemm_f32acc(M, N, K, A, lda, B, ldb, C, ldc);
+}
+
+/***************************************************************************
+ int8 GEMM
+
+ vpdpbusd multiplies unsigned bytes by signed bytes and adds groups of 4
+ products into int32 lanes, so:
+   - K is processed in groups of 4, packed A holds MR rows x 4 bytes per
+     group (one zmm = 16 rows), packed B holds NR columns x 4 bytes (one
+     int32 broadcast per column)
+   - A is stored +128 as unsigned, which adds 128 * sum_k(B[k][n]) to every
+     element of column n, that column sum is subtracted at the end.
+     int32 adds wrap, so intermediate overflow cancels out as long as the
+     final result fits
+ padded rows/columns are 0 (128 for A), padded k has B = 0 so it adds nothing.
+********************************************************/
+typedef void (*s8gemm_ukernel_t)(int kc4, const uint8_t *Ap, const int8_t *Bp,
+                                 int32_t *C, int ldc, int accumulate);
+
+struct s8gemm_kernel
+{
+    const char *        name;
+    int                 mr;
+    int                 nr;
+    s8gemm_ukernel_t    ukernel;
+};
+
+static void s8gemm_ukernel_scalar(int kc4, const uint8_t *Ap, const int8_t *Bp,
+                                  int32_t *C, int ldc, int accumulate)
+{
+    enum { MR = 8, NR = 4 };
+    uint32_t acc[NR][MR] = {{0}};   // unsigned: wraps like the SIMD version
+
+    for (int k = 0; k < kc4; k += 4) {
+        for (int j = 0; j < NR; j++)
+            for (int i = 0; i < MR; i++)
+                for (int q = 0; q < 4; q++)
+                    acc[j][i] += (uint32_t)((int32_t)Ap[i*4 + q] * (int32_t)Bp[j*4 + q]);
+        Ap += MR*4;
+        Bp += NR*4;
+    }
+
+    for (int j = 0; j < NR; j++)
+        for (int i = 0; i < MR; i++)
+            C[j*ldc + i] = (int32_t)(accumulate ? (uint32_t)C[j*ldc + i] + acc[j][i] : acc[j][i]);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static void s8gemm_ukernel_vnni(int kc4, const uint8_t *Ap, const int8_t *Bp,
+                                int32_t *C, int ldc, int accumulate)
+{
+    // 32x12 tile like the fp32 one, 4 k per instruction
+    enum { MR = 32, NR = 12 };
+    __m512i c[NR][2];
+
+    for (int j = 0; j < NR; j++)
+        c[j][0] = c[j][1] = _mm512_setzero_si512();
+
+    for (int k = 0; k < kc4; k += 4) {
+        __m512i a0 = _mm512_load_si512((const void *)Ap);
+        __m512i a1 = _mm512_load_si512((const void *)(Ap + 64));
+        for (int j = 0; j < NR; j++) {
+            int32_t b4;
+            memcpy(&b4, Bp + j*4, sizeof(b4));
+            __m512i b = _mm512_set1_epi32(b4);
+            c[j][0] = _mm512_dpbusd_epi32(c[j][0], a0, b);
+            c[j][1] = _mm512_dpbusd_epi32(c[j][1], a1, b);
+        }
+        Ap += MR*4;
+        Bp += NR*4;
+    }
+
+    for (int j = 0; j < NR; j++) {
+        int32_t *cj = C + j*ldc;
+        if (accumulate) {
+            c[j][0] = _mm512_add_epi32(c[j][0], _mm512_loadu_si512((const void *)cj));
+            c[j][1] = _mm512_add_epi32(c[j][1], _mm512_loadu_si512((const void *)(cj + 16)));
+        }
+        _mm512_storeu_si512((void *)cj, c[j][0]);
+        _mm512_storeu_si512((void *)(cj + 16), c[j][1]);
+    }
+}
+
+static const s8gemm_kernel s8kernels[] = {
+    {"avx512vnni", 32, 12, s8gemm_ukernel_vnni},
+    {"scalar",      8,  4, s8gemm_ukernel_scalar},
+};
+
+static const s8gemm_kernel * the_s8kernel(void)
+{
+    static const s8gemm_kernel * kern = []() {
+        const char * force = getenv("CPU_GEMM_KERNEL");
+        if (force && strcmp(force, "scalar") == 0)
+            return &s8kernels[1];
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw"))
+            return &s8kernels[0];
+        return &s8kernels[1];
+    }();
+    return kern;
+}
+
+const char * cpu_gemm_s8_kernel_name(void)
+{
+    return the_s8kernel()->name;
+}
+
+// kc rounded up to 4, A as unsigned (+128)
+static void pack_A_s8(int mc, int kc, const int8_t *A, int lda, uint8_t *Ap, int mr)
+{
+    for (int ir = 0; ir < mc; ir += mr) {
+        int m = mc - ir < mr ? mc - ir : mr;
+        for (int k = 0; k < kc; k += 4) {
+            for (int i = 0; i < mr; i++)
+                for (int q = 0; q < 4; q++)
+                    Ap[i*4 + q] = (i < m && k + q < kc) ?
+                                  (uint8_t)(A[(size_t)(k + q)*lda + ir + i] + 128) : 128;
+            Ap += mr*4;
+        }
+    }
+}
+
+static void pack_B_s8(int kc, int nc, const int8_t *B, int ldb, int8_t *Bp, int nr)
+{
+    for (int jr = 0; jr < nc; jr += nr) {
+        int n = nc - jr < nr ? nc - jr : nr;
+        for (int k = 0; k < kc; k += 4) {
+            for (int j = 0; j < nr; j++)
+                for (int q = 0; q < 4; q++)
+                    Bp[j*4 + q] = (j < n && k + q < kc) ? B[(size_t)(jr + j)*ldb + k + q] : 0;
+            Bp += nr*4;
+        }
+    }
+}
+
+static void s8gemm_macro_kernel(const s8gemm_kernel * kern, int mc, int nc, int kc4,
+                                const uint8_t *Ap, const int8_t *Bp,
+                                int32_t *C, int ldc, int accumulate)
+{
+    const int mr = kern->mr, nr = kern->nr;
+    int32_t edge[32*12] __attribute__((aligned(64)));
+
+    for (int jr = 0; jr < nc; jr += nr) {
+        int n = nc - jr < nr ? nc - jr : nr;
+        for (int ir = 0; ir < mc; ir += mr) {
+            int m = mc - ir < mr ? mc - ir : mr;
+            int32_t *c = C + jr*ldc + ir;
+            const uint8_t *a = Ap + ir*kc4;
+            const int8_t *b = Bp + jr*kc4;
+
+            if (m == mr && n == nr) {
+                kern->ukernel(kc4, a, b, c, ldc, accumulate);
+                continue;
+            }
+
+            if (accumulate)
+                for (int j = 0; j < n; j++)
+                    memcpy(edge + j*mr, c + j*ldc, m * sizeof(int32_t));
+            kern->ukernel(kc4, a, b, edge, mr, accumulate);
+            for (int j = 0; j < n; j++)
+                memcpy(c + j*ldc, edge + j*mr, m * sizeof(int32_t));
+        }
+    }
+}
+
+static void s8gemm_serial(const s8gemm_kernel * kern, const sgemm_blocking & blk,
+                          int M, int N, int K,
+                          const int8_t *A, int lda,
+                          const int8_t *B, int ldb,
+                          int32_t *C, int ldc)
+{
+    static thread_local uint8_t * Ap = NULL;
+    static thread_local int8_t * Bp = NULL;
+    static thread_local size_t Ap_cap = 0, Bp_cap = 0;
+
+    if (!grow_buffer(Ap, Ap_cap, (size_t)blk.mc * blk.kc) ||
+        !grow_buffer(Bp, Bp_cap, (size_t)blk.nc * blk.kc)) {
+        fprintf(stderr, "cpu_gemm_s8: out of memory\n");
+        return;
+    }
+
+    for (int jc = 0; jc < N; jc += blk.nc) {
+        int nc = N - jc < blk.nc ? N - jc : blk.nc;
+        for (int pc = 0; pc < K; pc += blk.kc) {
+            int kc = K - pc < blk.kc ? K - pc : blk.kc;
+            int kc4 = (kc + 3) & ~3;
+            pack_B_s8(kc, nc, B + (size_t)jc*ldb + pc, ldb, Bp, kern->nr);
+            for (int ic = 0; ic < M; ic += blk.mc) {
+                int mc = M - ic < blk.mc ? M - ic : blk.mc;
+                pack_A_s8(mc, kc, A + (size_t)pc*lda + ic, lda, Ap, kern->mr);
+                s8gemm_macro_kernel(kern, mc, nc, kc4, Ap, Bp,
+                                    C + (size_t)jc*ldc + ic, ldc, pc > 0);
+            }
+        }
+    }
+
+    // remove the +128 offset of A
+    for (int n = 0; n < N; n++) {
+        const int8_t *b = B + (size_t)n*ldb;
+        uint32_t sum = 0;
+        for (int k = 0; k < K; k++) sum += (uint32_t)(int32_t)b[k];
+        int32_t *c = C + (size_t)n*ldc;
+        for (int m = 0; m < M; m++)
+            c[m] = (int32_t)((uint32_t)c[m] - 128u * sum);
+    }
+}
+
+void cpu_gemm_s8(int M, int N, int K,
+                 const int8_t *A, int lda,
+                 const int8_t *B, int ldb,
+                 int32_t *C, int ldc)
+{
+    const s8gemm_kernel * kern = the_s8kernel();
+    static const sgemm_blocking blk = []() {
+        // same cache budget as fp32 with 1/4 of the element size: 4x deeper K
+        sgemm_kernel fake = {"s8", the_s8kernel()->mr, the_s8kernel()->nr, NULL};
+        sgemm_blocking b = select_blocking(&fake);
+        b.kc = (b.kc * 4 + 3) & ~3;
+        return b;
+    }();
+
+    if (M <= 0 || N <= 0)
+        return;
+    if (K <= 0) {
+        for (int n = 0; n < N; n++)
+            memset(C + (size_t)n*ldc, 0, M * sizeof(int32_t));
+        return;
+    }
+
+    gemm_parallel(M, N, K, kern->mr, kern->nr, [&](int m0, int m1, int n0, int n1) {
+        s8gemm_serial(kern, blk, m1 - m0, n1 - n0, K,
+                      A + m0, lda, B + (size_t)n0*ldb, ldb,
+                      C + (size_t)n0*ldc + m0, ldc);
+    });
+}
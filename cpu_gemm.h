@@ -0,0 +1,155 @@
+#ifndef _CPU_GEMM_H_
+#define _CPU_GEMM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * CPU single precision GEMM
+ *
+ *   C = A * B, all matrices are column-major (first dimension is continuous),
+ *   same layout as myGEMM.cl:
+ *      A: M*K, element (m,k) at A[k*lda + m]
+ *      B: K*N, element (k,n) at B[n*ldb + k]
+ *      C: M*N, element (m,n) at C[n*ldc + m]
+ *
+ * A & B are packed into cache-sized panels (block sizes derived from the
+ * L1/L2/L3 sizes), and register-blocked micro-kernels (AVX-512, AVX2+FMA or
+ * plain C) are selected at runtime by CPU features.
+ * env CPU_GEMM_KERNEL=avx512|avx2|scalar forces one of them.
+ *
+ * C is split in a 2D grid over a thread pool, every thread packs into its own
+ * buffers (first touched by itself, so NUMA local).
+ * env CPU_GEMM_THREADS sets the default thread count (all cores otherwise),
+ * env CPU_GEMM_AFFINITY=1 pins threads to cores.
+ */
+
+void cpu_sgemm(int M, int N, int K,
+               const float *A, int lda,
+               const float *B, int ldb,
+               float *C, int ldc);
+
+// name of the micro-kernel cpu_sgemm() dispatches to
+const char * cpu_sgemm_kernel_name(void);
+
+// measured FMA peak of that micro-kernel on all threads (cache resident,
+// no packing), the compute roof for cpu_sgemm(). runs for ~0.2 sec
+double cpu_sgemm_peak_gflops(void);
+
+// nthreads <= 0 restores the default, don't call while cpu_sgemm() is running
+// (applies to all cpu_gemm_* below as well)
+void cpu_sgemm_set_threads(int nthreads);
+int cpu_sgemm_get_threads(void);
+
+/*
+ * bf16/fp16 storage: A & B are converted to fp32 while they are packed, then
+ * the same fp32 micro-kernels & accumulation as cpu_sgemm() are used.
+ * memory traffic of A & B is halved, precision is that of the storage format.
+ */
+struct cpu_bf16 { uint16_t bits; };
+struct cpu_fp16 { uint16_t bits; };
+
+void cpu_gemm_bf16(int M, int N, int K,
+                   const cpu_bf16 *A, int lda,
+                   const cpu_bf16 *B, int ldb,
+                   float *C, int ldc);
+
+void cpu_gemm_fp16(int M, int N, int K,
+                   const cpu_fp16 *A, int lda,
+                   const cpu_fp16 *B, int ldb,
+                   float *C, int ldc);
+
+/*
+ * int8 x int8 -> int32, same layout as cpu_sgemm(), exact (no saturation
+ * as long as K < 2^17). AVX512-VNNI vpdpbusd when available, plain C otherwise.
+ */
+void cpu_gemm_s8(int M, int N, int K,
+                 const int8_t *A, int lda,
+                 const int8_t *B, int ldb,
+                 int32_t *C, int ldc);
+
+const char * cpu_gemm_s8_kernel_name(void);
+
+//=====================================================================
+// conversions, round to nearest even
+
+static inline float cpu_bf16_to_float(cpu_bf16 h)
+{
+    uint32_t u = (uint32_t)h.bits << 16;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline cpu_bf16 cpu_float_to_bf16(float f)
+{
+    uint32_t u;
+    cpu_bf16 h;
+    memcpy(&u, &f, sizeof(u));
+    if ((u & 0x7fffffff) > 0x7f800000)
+        h.bits = (uint16_t)((u >> 16) | 0x40);      // keep NaN a NaN
+    else
+        h.bits = (uint16_t)((u + 0x7fff + ((u >> 16) & 1)) >> 16);
+    return h;
+}
+
+static inline float cpu_fp16_to_float(cpu_fp16 h)
+{
+    uint32_t sign = (uint32_t)(h.bits & 0x8000) << 16;
+    uint32_t exp = (h.bits >> 10) & 0x1f;
+    uint32_t man = h.bits & 0x3ff;
+    uint32_t u;
+    float f;
+
+    if (exp == 0) {
+        if (man == 0) {
+            u = sign;
+        } else {
+            // subnormal, normalize it
+            exp = 127 - 15 + 1;
+            while (!(man & 0x400)) { man <<= 1; exp--; }
+            u = sign | (exp << 23) | ((man & 0x3ff) << 13);
+        }
+    } else if (exp == 31) {
+        u = sign | 0x7f800000 | (man << 13);
+    } else {
+        u = sign | ((exp + 127 - 15) << 23) | (man << 13);
+    }
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline cpu_fp16 cpu_float_to_fp16(float f)
+{
+    uint32_t u;
+    cpu_fp16 h;
+    memcpy(&u, &f, sizeof(u));
+
+    uint32_t sign = (u >> 16) & 0x8000;
+    int exp = (int)((u >> 23) & 0xff) - 127 + 15;
+    uint32_t man = u & 0x7fffff;
+
+    if (((u >> 23) & 0xff) == 0xff) {
+        h.bits = (uint16_t)(sign | 0x7c00 | (man ? 0x200 : 0));
+    } else if (exp >= 31) {
+        h.bits = (uint16_t)(sign | 0x7c00);         // overflow to inf
+    } else if (exp <= 0) {
+        if (exp < -10) {
+            h.bits = (uint16_t)sign;                // underflow to 0
+        } else {
+            // subnormal
+            int shift = 14 - exp;
+            man |= 0x800000;
+            uint32_t v = man >> shift, rem = man & ((1u << shift) - 1), half = 1u << (shift - 1);
+            if (rem > half || (rem == half && (v & 1))) v++;
+            h.bits = (uint16_t)(sign | v);
+        }
+    } else {
+        uint32_t v = ((uint32_t)exp << 10) | (man >> 13), rem = man & 0x1fff;
+        if (rem > 0x1000 || (rem == 0x1000 && (v & 1))) v++;   // may carry into inf, which is right
+        h.bits = (uint16_t)(sign | v);
+    }
+    return h;
+}
+
+#endif
@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "HLog.h"
+
+// render a binary log produced by HLOG_BINARY builds (see HLogOpenBinary)
+// usage: hlogdecode <binary log> [output text]
+int main(int argc, char * argv[])
+{
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s <binary log> [output text]\n", argv[0]);
+        return 1;
+    }
+
+    FILE * in = fopen(argv[1], "rb");
+    if(in == NULL) {
+        fprintf(stderr, "cannot open %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    FILE * out = stdout;
+    if(argc > 2 && (out = fopen(argv[2], "w")) == NULL) {
+        fprintf(stderr, "cannot open %s: %s\n", argv[2], strerror(errno));
+        return 1;
+    }
+
+    int cnt = HLogDecodeBinary(in, out);
+
+    fclose(in);
+    if(out != stdout) fclose(out);
+
+    if(cnt < 0) return 1;
+    fprintf(stderr, "%d records decoded\n", cnt);
+    return 0;
+}
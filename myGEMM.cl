@@ -14,7 +14,16 @@ __kernel void myAdd(const int M, const int N, const int K,
 }
 
 
-#define TS 16
+// compile time parameters, overridden by -D options from the host (see gemm_kernels in topencl.cpp)
+#ifndef TS
+#define TS 16       // tile size, work-group is TS x TS
+#endif
+#ifndef WPT
+#define WPT 1       // work per thread
+#endif
+#ifndef WIDTH
+#define WIDTH 1     // vector width
+#endif
 
 /***************************************************************************
  column-wised storing of matrix
@@ -212,3 +221,410 @@ __kernel void myGEMM2(const int M, const int N, const int K,
 }
 
 
+
+
+
+
+/***************************************************************************
+ myGEMM3: more work per thread
+
+ myGEMM2 issues 2 local memory loads per FMA, each work-item now computes
+ WPT elements of C in one row (strided by RTS columns), so Asub[k][row]
+ is loaded once and reused WPT times from register.
+
+ work-group is TS x TS/WPT
+********************************************************/
+#define RTS (TS/WPT)    // reduced tile size in one dimension
+
+__kernel void myGEMM3(const int M, const int N, const int K,
+                      const __global float* A,
+                      const __global float* B,
+                      __global float* C) {
+
+    // Thread identifiers
+    const int row = get_local_id(0); // Local row ID (max: TS)
+    const int col = get_local_id(1); // Local col ID (max: TS/WPT == RTS)
+    const int globalRow = TS*get_group_id(0) + row; // Row ID of C (0..M)
+    const int globalCol = TS*get_group_id(1) + col; // Col ID of C (0..N)
+
+    __local float Asub[TS][TS];
+    __local float Bsub[TS][TS];
+
+    float acc[WPT];
+    for (int w=0; w<WPT; w++) {
+        acc[w] = 0.0f;
+    }
+
+    const int numTiles = K/TS;
+    for (int t=0; t<numTiles; t++) {
+
+        // Load one tile of A and B into local memory, WPT elements each
+        for (int w=0; w<WPT; w++) {
+            const int tiledRow = TS*t + row;
+            const int tiledCol = TS*t + col;
+            Asub[col + w*RTS][row] = A[(tiledCol + w*RTS)*M + globalRow];
+            Bsub[col + w*RTS][row] = B[(globalCol + w*RTS)*K + tiledRow];
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (int k=0; k<TS; k++) {
+            const float a = Asub[k][row];
+            for (int w=0; w<WPT; w++) {
+                acc[w] += a * Bsub[col + w*RTS][k];
+            }
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    for (int w=0; w<WPT; w++) {
+        C[(globalCol + w*RTS)*M + globalRow] = acc[w];
+    }
+}
+
+
+
+
+/***************************************************************************
+ myGEMM4: wide memory access
+
+ A, B and C are accessed as floatX (WIDTH floats) so each load/store
+ moves WIDTH elements, each work-item computes WIDTH elements of C in a
+ column with vector FMAs.
+
+ work-group is TS/WIDTH x TS, M & K must be multiple of WIDTH
+********************************************************/
+#if WIDTH == 1
+    typedef float floatX;
+#elif WIDTH == 2
+    typedef float2 floatX;
+    #define vstoreX vstore2
+#elif WIDTH == 4
+    typedef float4 floatX;
+    #define vstoreX vstore4
+#elif WIDTH == 8
+    typedef float8 floatX;
+    #define vstoreX vstore8
+#endif
+
+float floatX_get(floatX v, int w)
+{
+#if WIDTH == 1
+    return v;
+#else
+    float s[WIDTH];
+    vstoreX(v, 0, s);
+    return s[w];
+#endif
+}
+
+__kernel void myGEMM4(const int M, const int N, const int K,
+                      const __global floatX* A,
+                      const __global floatX* B,
+                      __global floatX* C) {
+
+    // Thread identifiers
+    const int row = get_local_id(0); // Local row ID (max: TS/WIDTH)
+    const int col = get_local_id(1); // Local col ID (max: TS)
+    const int globalRow = (TS/WIDTH)*get_group_id(0) + row; // 0..M/WIDTH
+    const int globalCol = TS*get_group_id(1) + col; // 0..N
+
+    __local floatX Asub[TS][TS/WIDTH];
+    __local floatX Bsub[TS][TS/WIDTH];
+
+    floatX acc = (floatX)(0.0f);
+
+    const int numTiles = K/TS;
+    for (int t=0; t<numTiles; t++) {
+
+        const int tiledRow = (TS/WIDTH)*t + row;
+        const int tiledCol = TS*t + col;
+        Asub[col][row] = A[tiledCol*(M/WIDTH) + globalRow];
+        Bsub[col][row] = B[globalCol*(K/WIDTH) + tiledRow];
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (int k=0; k<TS/WIDTH; k++) {
+            const floatX vecB = Bsub[col][k];
+            for (int w=0; w<WIDTH; w++) {
+                acc += Asub[WIDTH*k + w][row] * floatX_get(vecB, w);
+            }
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    C[globalCol*(M/WIDTH) + globalRow] = acc;
+}
+
+
+
+
+/***************************************************************************
+ helpers for kernels working on transposed/padded inputs (myGEMM5/6),
+ the host runs them before & after the GEMM kernel
+
+ transpose: input P x Q  ->  output Q_XL x P_XL, zero padded
+            through a local memory tile so both read & write are coalesced
+********************************************************/
+#define TRANSPOSEX 16
+#define TRANSPOSEY 16
+
+__kernel void transpose(const int P, const int Q,
+                        const __global float* input,
+                        const int P_XL, const int Q_XL,
+                        __global float* output) {
+
+    const int tx = get_local_id(0);
+    const int ty = get_local_id(1);
+    const int ID0 = get_group_id(0)*TRANSPOSEX + tx; // 0..P_XL
+    const int ID1 = get_group_id(1)*TRANSPOSEY + ty; // 0..Q_XL
+
+    __local float buffer[TRANSPOSEX][TRANSPOSEY];
+
+    buffer[ty][tx] = (ID0 < P && ID1 < Q) ? input[ID1*P + ID0] : 0.0f;
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // swap the roles of tx & ty for the write
+    const int newID0 = get_group_id(1)*TRANSPOSEY + tx; // 0..Q_XL
+    const int newID1 = get_group_id(0)*TRANSPOSEX + ty; // 0..P_XL
+    if (newID0 < Q_XL && newID1 < P_XL) {
+        output[newID1*Q_XL + newID0] = buffer[tx][ty];
+    }
+}
+
+// input P x Q -> output P_XL x Q_XL, extra rows/cols are zero
+__kernel void paddingAddZeroes(const int P, const int Q,
+                               const __global float* input,
+                               const int P_XL, const int Q_XL,
+                               __global float* output) {
+
+    const int tx = get_global_id(0); // 0..P_XL
+    const int ty = get_global_id(1); // 0..Q_XL
+    if (tx < P_XL && ty < Q_XL) {
+        output[ty*P_XL + tx] = (tx < P && ty < Q) ? input[ty*P + tx] : 0.0f;
+    }
+}
+
+// input P_XL x Q_XL -> output P x Q
+__kernel void paddingRemoveZeroes(const int P_XL, const int Q_XL,
+                                  const __global float* input,
+                                  const int P, const int Q,
+                                  __global float* output) {
+
+    const int tx = get_global_id(0); // 0..P
+    const int ty = get_global_id(1); // 0..Q
+    if (tx < P && ty < Q) {
+        output[ty*P + tx] = input[ty*P_XL + tx];
+    }
+}
+
+
+
+
+/***************************************************************************
+ myGEMM5: myGEMM3 with pre-transposed B
+
+ B is given as BT (N x K), so a tile of B is read along N just like A is
+ read along M: every work-item reads consecutive addresses of both
+ matrices and Bsub is stored [k][n] like Asub.
+
+ M, N & K must be multiple of TS, the host pads them.
+********************************************************/
+__kernel void myGEMM5(const int M, const int N, const int K,
+                      const __global float* A,
+                      const __global float* BT,
+                      __global float* C) {
+
+    const int row = get_local_id(0); // Local row ID (max: TS)
+    const int col = get_local_id(1); // Local col ID (max: RTS)
+    const int offsetM = TS*get_group_id(0);
+    const int offsetN = TS*get_group_id(1);
+
+    __local float Asub[TS][TS];     // [k][m]
+    __local float Bsub[TS][TS];     // [k][n]
+
+    float acc[WPT];
+    for (int w=0; w<WPT; w++) {
+        acc[w] = 0.0f;
+    }
+
+    const int numTiles = K/TS;
+    for (int t=0; t<numTiles; t++) {
+
+        for (int w=0; w<WPT; w++) {
+            const int tiledK = TS*t + col + w*RTS;
+            Asub[col + w*RTS][row] = A[tiledK*M + offsetM + row];
+            Bsub[col + w*RTS][row] = BT[tiledK*N + offsetN + row];
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (int k=0; k<TS; k++) {
+            const float a = Asub[k][row];
+            for (int w=0; w<WPT; w++) {
+                acc[w] += a * Bsub[k][col + w*RTS];
+            }
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    for (int w=0; w<WPT; w++) {
+        C[(offsetN + col + w*RTS)*M + offsetM + row] = acc[w];
+    }
+}
+
+
+
+
+/***************************************************************************
+ myGEMM6: 2D register blocking
+
+ each work-item computes a WPT x WPT block of C (strided by RTS), per k it
+ loads WPT values of A and WPT values of B from local memory into registers
+ and does WPT*WPT FMAs out of them.
+
+ tile of C is TS x TS, tile of K is TSK, work-group is RTS x RTS and
+ every work-item loads LPT elements of A & B per tile.
+
+ takes BT like myGEMM5, M & N must be multiple of TS, K of TSK.
+********************************************************/
+#ifndef TSK
+#define TSK 16
+#endif
+#define LPT ((TSK*TS)/(RTS*RTS))    // loads per thread
+
+__kernel void myGEMM6(const int M, const int N, const int K,
+                      const __global float* A,
+                      const __global float* BT,
+                      __global float* C) {
+
+    const int tidm = get_local_id(0); // 0..RTS
+    const int tidn = get_local_id(1); // 0..RTS
+    const int offsetM = TS*get_group_id(0);
+    const int offsetN = TS*get_group_id(1);
+    const int tid = tidn*RTS + tidm;
+
+    __local float Asub[TSK][TS];    // [k][m]
+    __local float Bsub[TSK][TS];    // [k][n]
+
+    float Areg;
+    float Breg[WPT];
+    float acc[WPT][WPT];
+    for (int wm=0; wm<WPT; wm++) {
+        for (int wn=0; wn<WPT; wn++) {
+            acc[wm][wn] = 0.0f;
+        }
+    }
+
+    const int numTiles = K/TSK;
+    for (int t=0; t<numTiles; t++) {
+
+        // consecutive work-items load consecutive addresses
+        for (int la=0; la<LPT; la++) {
+            const int id = la*RTS*RTS + tid;
+            const int row = id % TS;
+            const int col = id / TS;
+            const int tiledK = TSK*t + col;
+            Asub[col][row] = A[tiledK*M + offsetM + row];
+            Bsub[col][row] = BT[tiledK*N + offsetN + row];
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (int k=0; k<TSK; k++) {
+            for (int wn=0; wn<WPT; wn++) {
+                Breg[wn] = Bsub[k][tidn + wn*RTS];
+            }
+            for (int wm=0; wm<WPT; wm++) {
+                Areg = Asub[k][tidm + wm*RTS];
+                for (int wn=0; wn<WPT; wn++) {
+                    acc[wm][wn] += Areg * Breg[wn];
+                }
+            }
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    for (int wm=0; wm<WPT; wm++) {
+        const int globalRow = offsetM + tidm + wm*RTS;
+        for (int wn=0; wn<WPT; wn++) {
+            const int globalCol = offsetN + tidn + wn*RTS;
+            C[globalCol*M + globalRow] = acc[wm][wn];
+        }
+    }
+}
+
+//=====================================================================
+// Low precision storage, same tiling as myGEMM2 (M, N, K multiples of TS).
+// Elements are widened when loaded into local memory and accumulated in
+// fp32 (int32 for int8), so only the global memory traffic shrinks.
+//   myGEMM2h    fp16 (vload_half, no cl_khr_fp16 needed)
+//   myGEMM2bf   bf16 stored as ushort, upper half of a float
+//   myGEMM2i8   int8 -> int32
+#define LOAD_HALF(p, i)     vload_half((i), (p))
+#define LOAD_BF16(p, i)     as_float((uint)(p)[i] << 16)
+#define LOAD_CHAR(p, i)     ((int)(p)[i])
+
+#define MYGEMM2_LOWP(NAME, TIN, TACC, LOAD)                                 \
+__kernel void NAME(const int M, const int N, const int K,                   \
+                   const __global TIN* A,                                   \
+                   const __global TIN* B,                                   \
+                   __global TACC* C) {                                      \
+    const int row = get_local_id(0);                                        \
+    const int col = get_local_id(1);                                        \
+    const int globalRow = TS*get_group_id(0) + row;                         \
+    const int globalCol = TS*get_group_id(1) + col;                         \
+                                                                            \
+    __local TACC Asub[TS][TS];                                              \
+    __local TACC Bsub[TS][TS];                                              \
+                                                                            \
+    TACC acc = 0;                                                           \
+    const int numTiles = K/TS;                                              \
+    for (int t=0; t<numTiles; t++) {                                        \
+        const int tiledRow = TS*t + row;                                    \
+        const int tiledCol = TS*t + col;                                    \
+        Asub[col][row] = LOAD(A, tiledCol*M + globalRow);                   \
+        Bsub[col][row] = LOAD(B, globalCol*K + tiledRow);                   \
+        barrier(CLK_LOCAL_MEM_FENCE);                                       \
+        for (int k=0; k<TS; k++) {                                          \
+            acc += Asub[k][row] * Bsub[col][k];                             \
+        }                                                                   \
+        barrier(CLK_LOCAL_MEM_FENCE);                                       \
+    }                                                                       \
+    C[globalCol*M + globalRow] = acc;                                       \
+}
+
+MYGEMM2_LOWP(myGEMM2h,  half,   float,  LOAD_HALF)
+MYGEMM2_LOWP(myGEMM2bf, ushort, float,  LOAD_BF16)
+MYGEMM2_LOWP(myGEMM2i8, char,   int,    LOAD_CHAR)
+
+//=====================================================================
+// Roofline probes for the benchmark sweep in topencl.cpp
+//   peakFMA      8 independent float4 mad chains per work-item,
+//                64*iters flops each, nothing but registers
+//   streamTriad  a = b + s*c, 3 x 16 bytes of traffic per work-item
+__kernel void peakFMA(const int iters, const float s, __global float* out) {
+    const float x = (float)get_global_id(0);
+    float4 v0 = (float4)(x), v1 = v0 + 1.0f, v2 = v0 + 2.0f, v3 = v0 + 3.0f;
+    float4 v4 = v0 + 4.0f, v5 = v0 + 5.0f, v6 = v0 + 6.0f, v7 = v0 + 7.0f;
+    const float4 vs = (float4)(s), one = (float4)(1.0f);
+    for (int i=0; i<iters; i++) {
+        v0 = mad(v0, vs, one); v1 = mad(v1, vs, one);
+        v2 = mad(v2, vs, one); v3 = mad(v3, vs, one);
+        v4 = mad(v4, vs, one); v5 = mad(v5, vs, one);
+        v6 = mad(v6, vs, one); v7 = mad(v7, vs, one);
+    }
+    float4 r = v0 + v1 + v2 + v3 + v4 + v5 + v6 + v7;
+    out[get_global_id(0)] = r.x + r.y + r.z + r.w;
+}
+
+__kernel void streamTriad(const __global float4* b, const __global float4* c,
+                          __global float4* a, const float s) {
+    const int i = get_global_id(0);
+    a[i] = b[i] + s*c[i];
+}
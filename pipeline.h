@@ -0,0 +1,248 @@
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <map>
+#include <functional>
+
+#include "thread_queue.h"
+
+/*
+ * dataflow pipeline over blocking_queue
+ *
+ *   pipeline<frame> p;
+ *   p.stage("detect", detect_fn, 2, pipeline<frame>::every(4));
+ *   p.stage("track",  track_fn);
+ *   p.start();
+ *   producer: p.push(f) ... p.close();
+ *   consumer: while(p.pop(f)) ...
+ *
+ * every item flows through every stage in push order. a stage runs its
+ * function on the items its rule accepts (all by default, every(n) takes
+ * sequence numbers 0, n, 2n...), the rest go through untouched.
+ *
+ * a stage has its own worker threads & a bounded queue in front of it, a
+ * full queue blocks the stage before it (push() for the first one).
+ * stages with several workers put their items back in sequence order, so
+ * the next stage always sees them in push order, a single worker stage
+ * can keep state from one item to the next (a tracker). a finished item
+ * may wait for up to workers * queue_len earlier ones, so a slow item
+ * doesn't hold up the workers behind it.
+ *
+ * T is copied through the queues, use a shared_ptr for big frames.
+ */
+template<class T>
+class pipeline
+{
+    typedef std::chrono::steady_clock clock;
+
+public:
+    typedef std::function<void(T &)> stage_fn;
+    typedef std::function<bool(uint64_t seq, const T &)> stage_rule;
+
+    // n < 1 is taken as 1
+    static stage_rule every(int n)
+    {
+        if(n < 1) n = 1;
+        return [n](uint64_t seq, const T &){ return seq % n == 0; };
+    }
+
+    struct stage_stats
+    {
+        std::atomic<uint64_t>   run;            // items the function ran on
+        std::atomic<uint64_t>   bypassed;       // items the rule skipped
+        std::atomic<uint64_t>   busy_ns;        // in the function, all workers
+        std::atomic<uint64_t>   order_wait_ns;  // done, too far ahead of an earlier item
+
+        stage_stats() : run(0), bypassed(0), busy_ns(0), order_wait_ns(0) {}
+    };
+
+    // pop() everything before the pipeline goes away, a stage blocked on a
+    // full output can't finish
+    pipeline() : _seq(0) {}
+    ~pipeline() { close(); join(); }
+
+    // add a stage after the last one, before start()
+    //   queue_len: length of the queue in front of it, also bounds how far
+    //              ahead a worker of a multi-worker stage may get
+    pipeline & stage(const char * name, stage_fn fn, int workers = 1,
+                     stage_rule rule = stage_rule(), int queue_len = 4)
+    {
+        std::unique_ptr<stage_t> st(new stage_t);
+        st->name = name;
+        st->fn = fn;
+        st->rule = rule;
+        st->workers = workers < 1 ? 1 : workers;
+        st->next_out = 0;
+        st->sending = false;
+        st->reorder_len = (uint64_t)st->workers * (queue_len < 1 ? 1 : queue_len);
+        st->running = 0;
+        st->in.reset(new queue(queue_len < 1 ? 1 : queue_len));
+        _stages.push_back(std::move(st));
+        return *this;
+    }
+
+    // output_len: how many finished items may wait for pop()
+    void start(int output_len = 16)
+    {
+        _out.reset(new queue(output_len));
+        for(size_t i = 0; i < _stages.size(); i++) {
+            stage_t & st = *_stages[i];
+            queue * out = i + 1 < _stages.size() ? _stages[i+1]->in.get() : _out.get();
+            st.running = st.workers;
+            for(int w = 0; w < st.workers; w++)
+                st.threads.emplace_back(&pipeline::worker, this, &st, out);
+        }
+    }
+
+    // from one producer thread, blocks while the first stage is backed up
+    void push(const T & obj)
+    {
+        item it;
+        it.seq = _seq++;
+        it.t_in = clock::now();
+        it.obj = obj;
+        first()->put(it);
+    }
+
+    // no more push(), the stages drain & stop
+    void close(void)
+    {
+        if(!_stages.empty()) _stages[0]->in->close();
+        else if(_out) _out->close();
+    }
+
+    // next finished item in push order, latency_ns: from push() to the end
+    // of the last stage
+    // return: false when closed & drained
+    bool pop(T & obj, uint64_t * latency_ns = NULL)
+    {
+        item it;
+        if(!_out->get(it)) return false;
+        obj = it.obj;
+        if(latency_ns)
+            *latency_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(it.t_out - it.t_in).count();
+        return true;
+    }
+
+    void join(void)
+    {
+        for(size_t i = 0; i < _stages.size(); i++) {
+            for(auto & th : _stages[i]->threads) th.join();
+            _stages[i]->threads.clear();
+        }
+    }
+
+    int stages(void) const { return _stages.size(); }
+    const char * stage_name(int i) const { return _stages[i]->name.c_str(); }
+    int stage_workers(int i) const { return _stages[i]->workers; }
+    const stage_stats & stats(int i) const { return _stages[i]->stats; }
+    // the queue in front of stage i, i == stages() is the output
+    const blocking_queue_stats & queue_stats(int i) const
+    {
+        return i < stages() ? _stages[i]->in->stats() : _out->stats();
+    }
+
+private:
+    struct item
+    {
+        uint64_t            seq;
+        clock::time_point   t_in;
+        clock::time_point   t_out;
+        T                   obj;
+    };
+    typedef blocking_queue<item> queue;
+
+    struct stage_t
+    {
+        std::string                 name;
+        stage_fn                    fn;
+        stage_rule                  rule;
+        int                         workers;
+        std::unique_ptr<queue>      in;
+        std::vector<std::thread>    threads;
+
+        // reorder buffer of a multi-worker stage
+        std::mutex                  order_m;
+        std::condition_variable     order_cv;
+        std::map<uint64_t, item>    pending;
+        uint64_t                    next_out;
+        uint64_t                    reorder_len;
+        bool                        sending;
+
+        std::atomic<int>            running;
+        stage_stats                 stats;
+    };
+
+    static uint64_t since(clock::time_point t0)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count();
+    }
+
+    queue * first(void) { return _stages.empty() ? _out.get() : _stages[0]->in.get(); }
+
+    void worker(stage_t * st, queue * out)
+    {
+        item it;
+        while(st->in->get(it)) {
+            if(!st->rule || st->rule(it.seq, it.obj)) {
+                clock::time_point t0 = clock::now();
+                st->fn(it.obj);
+                st->stats.busy_ns.fetch_add(since(t0), std::memory_order_relaxed);
+                st->stats.run.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                st->stats.bypassed.fetch_add(1, std::memory_order_relaxed);
+            }
+            it.t_out = clock::now();
+
+            if(st->workers == 1) {
+                out->put(it);
+                continue;
+            }
+
+            // park it until the earlier ones are out, whoever finishes the
+            // next one in order sends on everything that is ready behind it.
+            // a worker only waits when it is too far ahead
+            std::vector<item> ready;
+            std::unique_lock<std::mutex> lk(st->order_m);
+            if(it.seq >= st->next_out + st->reorder_len) {
+                clock::time_point t0 = clock::now();
+                st->order_cv.wait(lk, [st, &it]{ return it.seq < st->next_out + st->reorder_len; });
+                st->stats.order_wait_ns.fetch_add(since(t0), std::memory_order_relaxed);
+            }
+            st->pending[it.seq] = it;
+            if(st->pending.begin()->first != st->next_out || st->sending)
+                continue;
+
+            // one sender at a time keeps the order, it puts without the lock
+            // so the other workers can still park theirs while it is blocked
+            st->sending = true;
+            while(!st->pending.empty() && st->pending.begin()->first == st->next_out) {
+                for(auto p = st->pending.begin(); p != st->pending.end() && p->first == st->next_out;
+                    p = st->pending.erase(p)) {
+                    ready.push_back(p->second);
+                    st->next_out++;
+                }
+                st->order_cv.notify_all();
+                lk.unlock();
+                for(size_t i = 0; i < ready.size(); i++)
+                    out->put(ready[i]);
+                ready.clear();
+                lk.lock();
+            }
+            st->sending = false;
+        }
+
+        // the last worker out closes the next queue
+        if(--st->running == 0)
+            out->close();
+    }
+
+    std::vector<std::unique_ptr<stage_t>>   _stages;
+    std::unique_ptr<queue>                  _out;
+    uint64_t                                _seq;
+};
+
+#endif
@@ -1,8 +1,21 @@
 #include <cstdio>
+#include <cstdlib>
+#include <ctype.h>
 #include <string.h>
+#include <stdint.h>
+#include <immintrin.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <vector>
-#include <set>
+#include <string>
+#include <queue>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 //=====================================================================
 struct cube_edge_link{
@@ -13,6 +26,34 @@ struct cube_edge_link{
     int edge1;
 };
 
+// compact state: the position on the corners & edges ranked into one
+// 66 bit number hi:lo (8!*3^7 * 12!/2*2^11 = 4.3e19 states, too many for 64)
+struct cube_key
+{
+    uint64_t    lo;
+    uint8_t     hi;
+} __attribute__((packed));
+
+inline bool operator==(const cube_key & a, const cube_key & b) { return a.lo == b.lo && a.hi == b.hi; }
+inline bool operator<(const cube_key & a, const cube_key & b)  { return a.hi != b.hi ? a.hi < b.hi : a.lo < b.lo; }
+
+//=====================================================================
+// face turns as facelet permutations: after a turn s[i] = old s[perm[i]].
+// these are the clockwise quarter turns rotate_face() makes from peer_off,
+// cube::init_moves() checks that & composes the half & counter turns
+static constexpr uint8_t quarter_turn[6][48] = {
+    {2,3,4,5,6,7,0,1,  44,45,46,11,12,13,14,15,  8,9,10,19,20,21,22,23,  16,17,18,27,28,29,30,31,  32,33,34,35,36,37,38,39,  40,41,42,43,24,25,26,47},
+    {16,1,2,3,4,5,22,23,  10,11,12,13,14,15,8,9,  32,17,18,19,20,21,38,39,  24,25,26,27,28,29,30,31,  40,33,34,35,36,37,46,47,  0,41,42,43,44,45,6,7},
+    {0,1,2,3,30,31,24,7,  8,9,4,5,6,13,14,15,  18,19,20,21,22,23,16,17,  34,25,26,27,28,29,32,33,  10,11,12,35,36,37,38,39,  40,41,42,43,44,45,46,47},
+    {0,1,42,43,44,5,6,7,  8,9,10,11,12,13,14,15,  16,17,2,3,4,21,22,23,  26,27,28,29,30,31,24,25,  32,33,18,19,20,37,38,39,  40,41,34,35,36,45,46,47},
+    {0,1,2,3,4,5,6,7,  8,9,10,11,20,21,22,15,  16,17,18,19,28,29,30,23,  24,25,26,27,40,41,42,31,  34,35,36,37,38,39,32,33,  12,13,14,43,44,45,46,47},
+    {14,15,8,3,4,5,6,7,  38,9,10,11,12,13,36,37,  16,17,18,19,20,21,22,23,  24,25,0,1,2,29,30,31,  32,33,34,35,26,27,28,39,  42,43,44,45,46,47,40,41},
+};
+
+struct cube;
+typedef void (*cube_move_fn)(const cube * src, size_t n, const int * move, size_t nmove, cube * dst);
+typedef int (*cube_canon_fn)(const cube & c, cube & canon, int * stab);
+
 struct cube
 {
     static int peer_off[6][4*3];
@@ -34,11 +75,15 @@ struct cube
             {1,3,  5,3},
         };
         #define cntof(x) sizeof(x)/sizeof(x[0])
+        // sticker k of an edge runs the opposite way on the other face
         for(int i=0;i<cntof(el);i++){
             const cube_edge_link & e = el[i];
-            for(int k=0;k<3;k++) peer_off[e.face0][e.edge0*3+k] = &(get(e.face1, e.edge1, 3-k)) - s;
-            for(int k=0;k<3;k++) peer_off[e.face1][e.edge1*3+k] = &(get(e.face0, e.edge0, 3-k)) - s;
+            for(int k=0;k<3;k++) peer_off[e.face0][e.edge0*3+k] = &(get(e.face1, e.edge1, 2-k)) - s;
+            for(int k=0;k<3;k++) peer_off[e.face1][e.edge1*3+k] = &(get(e.face0, e.edge0, 2-k)) - s;
         }
+        init_cubies();
+        init_moves();
+        init_syms();
     }
     // 0 1 2
     // 7   3
@@ -68,6 +113,218 @@ struct cube
         for(;k<12+3;k++) temp[k] = s[peer_off[f][k-12]];
         for(k=0;k<12;k++) s[peer_off[f][k]] = temp[k+3];
     }
+
+    //=================================================================
+    // the 18 moves, m = face*3 + (quarter, half, counter) clockwise turns,
+    // applied as byte shuffles of the 48 facelets
+    struct move_table {
+        alignas(64) uint8_t perm[18][64];           // 48..63 stay, for vpermb
+        alignas(16) uint8_t shuf[18][3][3][16];     // [out lane][src lane] pshufb index, 0x80 if not from there
+    };
+    static move_table moves;
+    static cube_move_fn move_batch_fn;
+    static const char * move_kernel;
+
+    void init_moves();
+
+    void move(int m) { move_batch_fn(this, 1, &m, 1, this); }
+
+    // dst[i*nmove + j] = src[i] after move[j]
+    static void move_batch(const cube * src, size_t n, const int * move, size_t nmove, cube * dst)
+    {
+        move_batch_fn(src, n, move, nmove, dst);
+    }
+
+    //=================================================================
+    // the 48 symmetries of the cube (24 rotations x mirror): every map of
+    // the faces that keeps opposite faces opposite. conjugate k of a
+    // state moves the sticker at p to sym_pos[k][p] & recolors it by
+    // sym_face[k], so the solved cube stays solved.
+    // sym 0 is the identity
+    struct sym_table {
+        alignas(64) uint8_t gather[48][64];     // conjugate.s[q] = sym_face[k][s[gather[k][q]]]
+        alignas(64) uint8_t face[48][64];       // 6 used, for vpermb
+        uint8_t pos[48][48];
+        uint8_t move[48][18];                   // s after m, conjugated = conjugate after move[k][m]
+    };
+    static sym_table syms;
+    static cube_canon_fn canon_fn;
+
+    void init_syms();
+
+    void conjugate(int k, cube & out) const
+    {
+        for(int q=0;q<48;q++) out.s[q] = syms.face[k][(int)s[syms.gather[k][q]]];
+    }
+
+    // canon = the lexicographically smallest conjugate, same for every
+    // state of the class. return: which symmetry made it,
+    // stab (if not NULL) = how many symmetries leave this state as it is
+    int canonical(cube & canon, int * stab = NULL) const { return canon_fn(*this, canon, stab); }
+
+    //=================================================================
+    // cubie view of the stickers, for cube_key
+    //   corner slot: 3 stickers, [0] on face 0 or 4, twist = where the
+    //                face 0/4 color of the corner sits in its slot
+    //   edge slot:   2 stickers, [0] on face 0/4 if any, else on face 2/5,
+    //                flip = whether the edge's own [0] color isn't there
+    static int corner_slot[8][3];
+    static int edge_slot[12][2];
+    static signed char corner_of[6*6*6];     // slot colors -> corner*3 + twist
+    static signed char edge_of[6*6];         // slot colors -> edge*2 + flip
+    static char corner_color[8][3];          // colors of each corner, solved order
+    static char edge_color[12][2];
+
+    void init_cubies()
+    {
+        int nc = 0, ne = 0;
+        cube solved;
+        solved.reset();
+
+        for(int f=0;f<6;f++) {
+            for(int e=0;e<4;e++) {
+                int mid = f*8 + e*2 + 1;
+                int corner = f*8 + e*2;
+                int other = peer_off[f][e*3+1];
+                // every edge seen once, from its primary face
+                if(primary(mid, other))
+                    edge_slot[ne][0] = mid, edge_slot[ne][1] = other, ne++;
+                // corner at the start of edge e: neighbors through edge e & e-1
+                if(f == 0 || f == 4) {
+                    corner_slot[nc][0] = corner;
+                    corner_slot[nc][1] = peer_off[f][e*3];
+                    corner_slot[nc][2] = peer_off[f][((e+3)%4)*3+2];
+                    nc++;
+                }
+            }
+        }
+
+        memset(corner_of, -1, sizeof(corner_of));
+        memset(edge_of, -1, sizeof(edge_of));
+        for(int c=0;c<8;c++) {
+            for(int k=0;k<3;k++) corner_color[c][k] = solved.s[corner_slot[c][k]];
+            for(int t=0;t<3;t++) {
+                char r[3];
+                for(int k=0;k<3;k++) r[(t+k)%3] = corner_color[c][k];
+                corner_of[r[0]*36 + r[1]*6 + r[2]] = c*3 + t;
+            }
+        }
+        for(int e=0;e<12;e++) {
+            for(int k=0;k<2;k++) edge_color[e][k] = solved.s[edge_slot[e][k]];
+            edge_of[edge_color[e][0]*6 + edge_color[e][1]] = e*2;
+            edge_of[edge_color[e][1]*6 + edge_color[e][0]] = e*2 + 1;
+        }
+    }
+
+    // does sticker a (not b) carry the orientation of the edge a-b
+    static bool primary(int a, int b)
+    {
+        int fa = a/8, fb = b/8;
+        bool ud_a = (fa == 0 || fa == 4), ud_b = (fb == 0 || fb == 4);
+        if(ud_a != ud_b) return ud_a;
+        if(ud_a) return false;  // can't happen, 0 & 4 are opposite
+        return fa == 2 || fa == 5;
+    }
+
+    cube_key key() const
+    {
+        static const uint32_t fact[12] = {1,1,2,6,24,120,720,5040,40320,362880,3628800,39916800};
+        uint32_t cp = 0, ct = 0, used = 0;
+        uint64_t ep = 0, ef = 0;
+
+        for(int i=0;i<8;i++) {
+            int v = corner_of[s[corner_slot[i][0]]*36 + s[corner_slot[i][1]]*6 + s[corner_slot[i][2]]];
+            int c = v/3;
+            cp += __builtin_popcount(~used & ((1u << c) - 1)) * fact[7-i];
+            used |= 1u << c;
+            if(i < 7) ct = ct*3 + v%3;
+        }
+        used = 0;
+        for(int i=0;i<12;i++) {
+            int v = edge_of[s[edge_slot[i][0]]*6 + s[edge_slot[i][1]]];
+            int e = v/2;
+            ep += __builtin_popcount(~used & ((1u << e) - 1)) * (uint64_t)fact[11-i];
+            used |= 1u << e;
+            if(i < 11) ef = ef*2 + v%2;
+        }
+
+        // lowest digit of the edge rank is fixed by the permutation parity
+        unsigned __int128 r = (uint64_t)cp * 2187 + ct;
+        r = (r * (479001600/2) + ep/2) * 2048 + ef;
+        cube_key k;
+        k.lo = (uint64_t)r;
+        k.hi = (uint8_t)(r >> 64);
+        return k;
+    }
+
+    // cubie positions, cpos[c] = slot*3 + twist of corner c,
+    // epos[e] = slot*2 + flip of edge e
+    void cubies(uint8_t cpos[8], uint8_t epos[12]) const
+    {
+        for(int i=0;i<8;i++) {
+            int v = corner_of[s[corner_slot[i][0]]*36 + s[corner_slot[i][1]]*6 + s[corner_slot[i][2]]];
+            cpos[v/3] = i*3 + v%3;
+        }
+        for(int i=0;i<12;i++) {
+            int v = edge_of[s[edge_slot[i][0]]*6 + s[edge_slot[i][1]]];
+            epos[v/2] = i*2 + v%2;
+        }
+    }
+
+    void set(const cube_key & k)
+    {
+        static const uint32_t fact[12] = {1,1,2,6,24,120,720,5040,40320,362880,3628800,39916800};
+        unsigned __int128 r = ((unsigned __int128)k.hi << 64) | k.lo;
+        uint32_t ef = (uint32_t)(r % 2048);         r /= 2048;
+        uint64_t ep = (uint64_t)(r % (479001600/2)); r /= 479001600/2;
+        uint32_t ct = (uint32_t)(r % 2187);
+        uint32_t cp = (uint32_t)(r / 2187);
+        int corner[8], twist[8], edge[12], flip[12];
+        int parity = 0, sum;
+
+        // unrank corners, twists sum to 0 mod 3
+        uint32_t left = 0xFF;
+        for(int i=0;i<8;i++) {
+            int d = cp / fact[7-i];
+            cp %= fact[7-i];
+            parity += d;
+            corner[i] = nth_bit(left, d);
+            left &= ~(1u << corner[i]);
+        }
+        sum = 0;
+        for(int i=6;i>=0;i--) { twist[i] = ct % 3; ct /= 3; sum += twist[i]; }
+        twist[7] = (3 - sum%3) % 3;
+
+        // unrank edges, the dropped digit makes both parities equal
+        ep *= 2;
+        {
+            int lehmer = 0;
+            uint64_t t = ep;
+            for(int i=0;i<12;i++) { lehmer += t / fact[11-i]; t %= fact[11-i]; }
+            if((lehmer & 1) != (parity & 1)) ep += 1;
+        }
+        left = 0xFFF;
+        for(int i=0;i<12;i++) {
+            int d = ep / fact[11-i];
+            ep %= fact[11-i];
+            edge[i] = nth_bit(left, d);
+            left &= ~(1u << edge[i]);
+        }
+        sum = 0;
+        for(int i=10;i>=0;i--) { flip[i] = ef & 1; ef >>= 1; sum += flip[i]; }
+        flip[11] = sum & 1;
+
+        for(int i=0;i<8;i++)
+            for(int k=0;k<3;k++) s[corner_slot[i][(twist[i]+k)%3]] = corner_color[corner[i]][k];
+        for(int i=0;i<12;i++)
+            for(int k=0;k<2;k++) s[edge_slot[i][(flip[i]+k)%2]] = edge_color[edge[i]][k];
+    }
+
+    static int nth_bit(uint32_t mask, int n)
+    {
+        while(n--) mask &= mask - 1;
+        return __builtin_ctz(mask);
+    }
 };
 
 bool operator==(const cube & a, const cube & b)
@@ -79,54 +336,1605 @@ bool operator<(const cube & a, const cube & b)
 	return memcmp(a.s, b.s, sizeof(a.s)) < 0;
 }
 int cube::peer_off[6][4*3]={0};
+int cube::corner_slot[8][3];
+int cube::edge_slot[12][2];
+signed char cube::corner_of[6*6*6];
+signed char cube::edge_of[6*6];
+char cube::corner_color[8][3];
+char cube::edge_color[12][2];
+cube::move_table cube::moves;
+cube_move_fn cube::move_batch_fn;
+const char * cube::move_kernel;
+cube::sym_table cube::syms;
+cube_canon_fn cube::canon_fn;
+
+static void move_batch_scalar(const cube * src, size_t n, const int * move, size_t nmove, cube * dst)
+{
+    for(size_t i=0;i<n;i++) {
+        char in[48];
+        memcpy(in, src[i].s, 48);
+        for(size_t j=0;j<nmove;j++) {
+            const uint8_t * p = cube::moves.perm[move[j]];
+            char * out = dst[i*nmove + j].s;
+            for(int k=0;k<48;k++) out[k] = in[p[k]];
+        }
+    }
+}
+
+// 3 lanes of 16: every output lane is or-ed from a pshufb of each source lane
+__attribute__((target("ssse3")))
+static void move_batch_ssse3(const cube * src, size_t n, const int * move, size_t nmove, cube * dst)
+{
+    for(size_t i=0;i<n;i++) {
+        __m128i in[3];
+        for(int l=0;l<3;l++) in[l] = _mm_loadu_si128((const __m128i *)(src[i].s + l*16));
+        for(size_t j=0;j<nmove;j++) {
+            const uint8_t (*sh)[3][16] = cube::moves.shuf[move[j]];
+            char * out = dst[i*nmove + j].s;
+            for(int o=0;o<3;o++) {
+                __m128i v = _mm_shuffle_epi8(in[0], _mm_load_si128((const __m128i *)sh[o][0]));
+                v = _mm_or_si128(v, _mm_shuffle_epi8(in[1], _mm_load_si128((const __m128i *)sh[o][1])));
+                v = _mm_or_si128(v, _mm_shuffle_epi8(in[2], _mm_load_si128((const __m128i *)sh[o][2])));
+                _mm_storeu_si128((__m128i *)(out + o*16), v);
+            }
+        }
+    }
+}
+
+// the whole state in one zmm, one vpermb per move
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static void move_batch_vbmi(const cube * src, size_t n, const int * move, size_t nmove, cube * dst)
+{
+    const __mmask64 m48 = (1ull << 48) - 1;
+    __m512i perm[18];
+    for(size_t j=0;j<18;j++) perm[j] = j < nmove ? _mm512_load_si512(cube::moves.perm[move[j]]) : _mm512_setzero_si512();
+    for(size_t i=0;i<n;i++) {
+        __m512i in = _mm512_maskz_loadu_epi8(m48, src[i].s);
+        for(size_t j=0;j<nmove;j++) {
+            __m512i p = j < 18 ? perm[j] : _mm512_load_si512(cube::moves.perm[move[j]]);
+            _mm512_mask_storeu_epi8(dst[i*nmove + j].s, m48, _mm512_maskz_permutexvar_epi8(m48, p, in));
+        }
+    }
+}
+
+void cube::init_moves()
+{
+    for(int f=0;f<6;f++) {
+        cube a;
+        for(int k=0;k<48;k++) a.s[k] = k;
+        a.rotate_face(f);
+        if(memcmp(a.s, quarter_turn[f], 48) != 0) {
+            fprintf(stderr, "quarter_turn[%d] doesn't match rotate_face()\n", f);
+            abort();
+        }
+        // half = quarter twice, counter = three times
+        for(int t=0;t<3;t++) {
+            uint8_t * p = moves.perm[f*3 + t];
+            for(int k=0;k<64;k++) p[k] = k;
+            for(int q=0;q<=t;q++) {
+                uint8_t prev[48];
+                memcpy(prev, p, 48);
+                for(int k=0;k<48;k++) p[k] = prev[quarter_turn[f][k]];
+            }
+        }
+    }
+    for(int m=0;m<18;m++)
+        for(int o=0;o<3;o++)
+            for(int l=0;l<3;l++)
+                for(int k=0;k<16;k++) {
+                    int from = moves.perm[m][o*16 + k];
+                    moves.shuf[m][o][l][k] = from/16 == l ? from%16 : 0x80;
+                }
+
+    // env TCUBE_KERNEL=vbmi|ssse3|scalar forces one
+    __builtin_cpu_init();
+    const struct { const char * name; cube_move_fn fn; bool usable; } kernels[] = {
+        {"vbmi",    move_batch_vbmi,    __builtin_cpu_supports("avx512vbmi") && __builtin_cpu_supports("avx512bw")},
+        {"ssse3",   move_batch_ssse3,   __builtin_cpu_supports("ssse3") != 0},
+        {"scalar",  move_batch_scalar,  true},
+    };
+    const char * force = getenv("TCUBE_KERNEL");
+    for(size_t i=0;i<sizeof(kernels)/sizeof(kernels[0]);i++) {
+        if(force ? strcmp(force, kernels[i].name) != 0 : !kernels[i].usable)
+            continue;
+        move_batch_fn = kernels[i].fn;
+        move_kernel = kernels[i].name;
+        return;
+    }
+    if(force) fprintf(stderr, "TCUBE_KERNEL=%s is unknown, use scalar\n", force);
+    move_batch_fn = move_batch_scalar;
+    move_kernel = "scalar";
+}
+
+static int canon_scalar(const cube & c, cube & canon, int * stab)
+{
+    int best = 0, same = 1;
+    canon = c;
+    for(int k=1;k<48;k++) {
+        cube t;
+        c.conjugate(k, t);
+        int d = memcmp(t.s, canon.s, 48);
+        if(d < 0) canon = t, best = k;
+        if(stab && memcmp(t.s, c.s, 48) == 0) same++;
+    }
+    if(stab) *stab = same;
+    return best;
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi,bmi")))
+static int canon_vbmi(const cube & c, cube & canon, int * stab)
+{
+    const __mmask64 m48 = (1ull << 48) - 1;
+    __m512i in = _mm512_maskz_loadu_epi8(m48, c.s);
+    __m512i best = in;
+    int best_k = 0, same = 1;
+    for(int k=1;k<48;k++) {
+        __m512i t = _mm512_maskz_permutexvar_epi8(m48, _mm512_load_si512(cube::syms.gather[k]), in);
+        t = _mm512_maskz_permutexvar_epi8(m48, t, _mm512_load_si512(cube::syms.face[k]));
+        // the first byte that differs decides
+        uint64_t ne = _mm512_mask_cmpneq_epi8_mask(m48, t, best);
+        if(ne) {
+            int at = __builtin_ctzll(ne);
+            alignas(64) uint8_t tb[64], bb[64];
+            _mm512_store_si512(tb, t);
+            _mm512_store_si512(bb, best);
+            if(tb[at] < bb[at]) best = t, best_k = k;
+        }
+        same += _mm512_mask_cmpneq_epi8_mask(m48, t, in) == 0;
+    }
+    _mm512_mask_storeu_epi8(canon.s, m48, best);
+    if(stab) *stab = same;
+    return best_k;
+}
+
+void cube::init_syms()
+{
+    static const int opposite[6] = {4, 3, 5, 1, 0, 2};
+    int sigma[6] = {0, 1, 2, 3, 4, 5};
+    int n = 0;
+
+    do {
+        bool ok = true;
+        for(int f=0;f<6;f++) ok = ok && sigma[opposite[f]] == opposite[sigma[f]];
+        if(!ok) continue;
+
+        // a cubie goes to the one on the mapped faces, each sticker to the mapped face
+        uint8_t * pos = syms.pos[n];
+        for(int c=0;c<8;c++)
+            for(int d=0;d<8;d++) {
+                int hit = 0;
+                for(int k=0;k<3;k++)
+                    for(int j=0;j<3;j++)
+                        if(corner_slot[d][j]/8 == sigma[corner_slot[c][k]/8]) hit++;
+                if(hit == 3)
+                    for(int k=0;k<3;k++)
+                        for(int j=0;j<3;j++)
+                            if(corner_slot[d][j]/8 == sigma[corner_slot[c][k]/8]) pos[corner_slot[c][k]] = corner_slot[d][j];
+            }
+        for(int e=0;e<12;e++)
+            for(int d=0;d<12;d++) {
+                int hit = 0;
+                for(int k=0;k<2;k++)
+                    for(int j=0;j<2;j++)
+                        if(edge_slot[d][j]/8 == sigma[edge_slot[e][k]/8]) hit++;
+                if(hit == 2)
+                    for(int k=0;k<2;k++)
+                        for(int j=0;j<2;j++)
+                            if(edge_slot[d][j]/8 == sigma[edge_slot[e][k]/8]) pos[edge_slot[e][k]] = edge_slot[d][j];
+            }
+        for(int p=0;p<48;p++) syms.gather[n][pos[p]] = p;
+        for(int p=48;p<64;p++) syms.gather[n][p] = p;
+        memset(syms.face[n], 0, 64);
+        for(int f=0;f<6;f++) syms.face[n][f] = sigma[f];
+        n++;
+    } while(std::next_permutation(sigma, sigma + 6));
+
+    // conjugated moves, found on the solved cube & checked on a scrambled one
+    cube solved, mixed;
+    solved.reset();
+    mixed.reset();
+    for(int i=0;i<20;i++) mixed.move((i*7 + i/3) % 18);
+    for(int k=0;k<48;k++)
+        for(int m=0;m<18;m++) {
+            cube a = solved, ca, cb;
+            a.move(m);
+            a.conjugate(k, ca);
+            int found = -1;
+            for(int m2=0;m2<18 && found<0;m2++) {
+                cube t = solved;
+                t.move(m2);
+                if(t == ca) found = m2;
+            }
+            a = mixed;
+            a.move(m);
+            a.conjugate(k, ca);
+            mixed.conjugate(k, cb);
+            if(found >= 0) cb.move(found);
+            if(found < 0 || !(ca == cb)) {
+                fprintf(stderr, "symmetry %d doesn't map move %d to a move\n", k, m);
+                abort();
+            }
+            syms.move[k][m] = found;
+        }
+
+    canon_fn = strcmp(move_kernel, "vbmi") == 0 ? canon_vbmi : canon_scalar;
+}
+
+//=====================================================================
+// visited set of cube_key: open addressing, linear probing, one table of
+// the 64 bit lo part per hi value, 8 bytes per slot, grows at 3/4 load
+class cube_set
+{
+public:
+    explicit cube_set(int size_log2 = 16) : _count(0)
+    {
+        for(int h=0;h<HI;h++) {
+            _tab[h].assign((size_t)1 << size_log2, EMPTY);
+            _used[h] = 0;
+            _has_empty[h] = false;
+        }
+    }
+
+    // return: true if k was not in the set
+    bool insert(const cube_key & k)
+    {
+        int h = k.hi;
+        if(k.lo == EMPTY) {
+            if(_has_empty[h]) return false;
+            _has_empty[h] = true;
+            _count++;
+            return true;
+        }
+        if((_used[h] + 1) * 4 > _tab[h].size() * 3)
+            grow(h);
+        if(!put(_tab[h], k.lo)) return false;
+        _used[h]++;
+        _count++;
+        return true;
+    }
+
+    bool find(const cube_key & k) const
+    {
+        int h = k.hi;
+        if(k.lo == EMPTY) return _has_empty[h];
+        const std::vector<uint64_t> & t = _tab[h];
+        size_t mask = t.size() - 1;
+        for(size_t i = hash(k.lo) & mask; t[i] != EMPTY; i = (i + 1) & mask)
+            if(t[i] == k.lo) return true;
+        return false;
+    }
+
+    size_t size() const { return _count; }
+
+    size_t memory() const
+    {
+        size_t m = 0;
+        for(int h=0;h<HI;h++) m += _tab[h].capacity() * sizeof(uint64_t);
+        return m;
+    }
+
+    static uint64_t hash(uint64_t x)
+    {
+        x ^= x >> 31; x *= 0x7fb5d329728ea185ull;
+        x ^= x >> 27; x *= 0x81dadef4bc2dd44dull;
+        return x ^ (x >> 33);
+    }
+
+private:
+    enum { HI = 4 };        // 4.3e19 >> 64 < 3
+    static const uint64_t EMPTY = ~(uint64_t)0;
+
+    static bool put(std::vector<uint64_t> & t, uint64_t v)
+    {
+        size_t mask = t.size() - 1;
+        size_t i = hash(v) & mask;
+        for(; t[i] != EMPTY; i = (i + 1) & mask)
+            if(t[i] == v) return false;
+        t[i] = v;
+        return true;
+    }
+
+    void grow(int h)
+    {
+        std::vector<uint64_t> t(_tab[h].size() * 2, EMPTY);
+        for(size_t i = 0; i < _tab[h].size(); i++)
+            if(_tab[h][i] != EMPTY) put(t, _tab[h][i]);
+        _tab[h].swap(t);
+    }
+
+    std::vector<uint64_t>   _tab[HI];
+    size_t                  _used[HI];
+    bool                    _has_empty[HI];
+    size_t                  _count;
+};
+const uint64_t cube_set::EMPTY;
+
+//=====================================================================
+// cube_set with a 32 bit value per key, same tables & probing, the
+// values sit in a parallel array (12 bytes per slot)
+class cube_map
+{
+public:
+    cube_map() : _count(0)
+    {
+        for(int h=0;h<HI;h++) {
+            _key[h].assign(1 << 16, EMPTY);
+            _val[h].resize(1 << 16);
+            _used[h] = 0;
+            _has_empty[h] = false;
+        }
+    }
+
+    // return: true if k was not in the map (then it maps to v)
+    bool insert(const cube_key & k, uint32_t v)
+    {
+        int h = k.hi;
+        if(k.lo == EMPTY) {
+            if(_has_empty[h]) return false;
+            _has_empty[h] = true;
+            _empty_val[h] = v;
+            _count++;
+            return true;
+        }
+        if((_used[h] + 1) * 4 > _key[h].size() * 3)
+            grow(h);
+        if(!put(_key[h], _val[h], k.lo, v)) return false;
+        _used[h]++;
+        _count++;
+        return true;
+    }
+
+    bool find(const cube_key & k, uint32_t & v) const
+    {
+        int h = k.hi;
+        if(k.lo == EMPTY) {
+            v = _empty_val[h];
+            return _has_empty[h];
+        }
+        const std::vector<uint64_t> & t = _key[h];
+        size_t mask = t.size() - 1;
+        for(size_t i = cube_set::hash(k.lo) & mask; t[i] != EMPTY; i = (i + 1) & mask)
+            if(t[i] == k.lo) {
+                v = _val[h][i];
+                return true;
+            }
+        return false;
+    }
+
+    size_t size() const { return _count; }
+
+    size_t memory() const
+    {
+        size_t m = 0;
+        for(int h=0;h<HI;h++) m += _key[h].capacity() * sizeof(uint64_t) + _val[h].capacity() * sizeof(uint32_t);
+        return m;
+    }
+
+private:
+    enum { HI = 4 };
+    static const uint64_t EMPTY = ~(uint64_t)0;
+
+    static bool put(std::vector<uint64_t> & t, std::vector<uint32_t> & val, uint64_t k, uint32_t v)
+    {
+        size_t mask = t.size() - 1;
+        size_t i = cube_set::hash(k) & mask;
+        for(; t[i] != EMPTY; i = (i + 1) & mask)
+            if(t[i] == k) return false;
+        t[i] = k;
+        val[i] = v;
+        return true;
+    }
+
+    void grow(int h)
+    {
+        std::vector<uint64_t> t(_key[h].size() * 2, EMPTY);
+        std::vector<uint32_t> val(t.size());
+        for(size_t i = 0; i < _key[h].size(); i++)
+            if(_key[h][i] != EMPTY) put(t, val, _key[h][i], _val[h][i]);
+        _key[h].swap(t);
+        _val[h].swap(val);
+    }
+
+    std::vector<uint64_t>   _key[HI];
+    std::vector<uint32_t>   _val[HI];
+    size_t                  _used[HI];
+    bool                    _has_empty[HI];
+    uint32_t                _empty_val[HI];
+    size_t                  _count;
+};
+const uint64_t cube_map::EMPTY;
+
+//=====================================================================
+// cube_set for many threads: SHARDS independent sets picked by the top
+// bits of the hash (the tables index with the low bits), one lock each
+class cube_set_mt
+{
+public:
+    bool insert(const cube_key & k)
+    {
+        shard & s = _shard[cube_set::hash(k.lo ^ k.hi) >> (64 - SHARD_BITS)];
+        std::lock_guard<std::mutex> lk(s.lock);
+        return s.set.insert(k);
+    }
+
+    size_t size() const
+    {
+        size_t n = 0;
+        for(int i=0;i<SHARDS;i++) n += _shard[i].set.size();
+        return n;
+    }
+
+    size_t memory() const
+    {
+        size_t m = 0;
+        for(int i=0;i<SHARDS;i++) m += _shard[i].set.memory();
+        return m;
+    }
+
+private:
+    enum { SHARD_BITS = 8, SHARDS = 1 << SHARD_BITS };
+    struct shard {
+        shard() : set(8) {}
+        std::mutex  lock;
+        cube_set    set;
+        char        pad[64];    // keep neighbor locks off the same line
+    };
+    shard   _shard[SHARDS];
+};
+
+// states decoded & moved together, the children stay in L1
+enum { MOVE_BATCH = 32 };
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// cw:  the 6 clockwise quarter turns (not closed under inverse)
+// qtm: 12 quarter turns, both directions
+// htm: 18 quarter & half turns
+static bool move_set(const char * name, std::vector<int> & moves)
+{
+    moves.clear();
+    for(int m=0;m<18;m++) {
+        if(strcmp(name, "cw") == 0 && m%3 == 0) moves.push_back(m);
+        else if(strcmp(name, "qtm") == 0 && m%3 != 1) moves.push_back(m);
+        else if(strcmp(name, "htm") == 0) moves.push_back(m);
+    }
+    return moves.size() > 0;
+}
+
+//=====================================================================
+// move pruning: skip move m right after move last if
+//   - same face & the two together are no turn or one move of the set,
+//     the result is at the current depth or above
+//   - opposite faces (they commute) in decreasing face order, when
+//     order_opposite is set
+// every state is still reached at its depth, through another sequence
+enum { NO_MOVE = 18 };
+
+struct move_pruning
+{
+    bool skip[NO_MOVE + 1][18];
+
+    move_pruning(const std::vector<int> & moves, bool order_opposite)
+    {
+        static const int opposite[6] = {4, 3, 5, 1, 0, 2};
+        bool in_set[18] = {false};
+        for(size_t i=0;i<moves.size();i++) in_set[moves[i]] = true;
+
+        memset(skip, 0, sizeof(skip));
+        for(int last=0;last<18;last++)
+            for(int m=0;m<18;m++) {
+                int turns = (last%3 + 1 + m%3 + 1) % 4;
+                if(last/3 == m/3)
+                    skip[last][m] = turns == 0 || in_set[m/3*3 + turns - 1];
+                else if(order_opposite && opposite[last/3] == m/3)
+                    skip[last][m] = m/3 < last/3;
+            }
+    }
+};
+
+//=====================================================================
+// external memory BFS with delayed duplicate detection
+//
+// every level is a file of sorted unique cube_key. the next level is made
+// from the current file in pieces that fit the memory budget, every piece
+// is sorted & written as a run, then the runs are merged and whatever is
+// in the current or the previous level is dropped. with a move set closed
+// under inverse, a successor of level d can't be older than d-1.
+
+class key_reader
+{
+public:
+    key_reader(const std::string & path, size_t buf_bytes) : _fd(-1), _pos(0), _len(0)
+    {
+        _buf.resize(buf_bytes / sizeof(cube_key) * sizeof(cube_key));
+        if(path.empty()) return;
+        _fd = ::open(path.c_str(), O_RDONLY);
+        if(_fd < 0) { perror(path.c_str()); exit(1); }
+        posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    ~key_reader() { if(_fd >= 0) ::close(_fd); }
+
+    // return: false at the end of file
+    bool next(cube_key & k)
+    {
+        if(_pos == _len && !fill()) return false;
+        memcpy(&k, &_buf[_pos], sizeof(k));
+        _pos += sizeof(k);
+        return true;
+    }
+
+    // read keys in bulk, return: number of keys, 0 at the end
+    size_t next(cube_key * k, size_t n)
+    {
+        size_t got = 0;
+        while(got < n && (_pos < _len || fill())) {
+            size_t c = std::min(n - got, (_len - _pos) / sizeof(cube_key));
+            memcpy(k + got, &_buf[_pos], c * sizeof(cube_key));
+            _pos += c * sizeof(cube_key);
+            got += c;
+        }
+        return got;
+    }
+
+private:
+    bool fill()
+    {
+        if(_fd < 0) return false;
+        ssize_t r = ::read(_fd, &_buf[0], _buf.size());
+        if(r < 0) { perror("read"); exit(1); }
+        if(r % sizeof(cube_key)) { fprintf(stderr, "truncated key file\n"); exit(1); }
+        _pos = 0;
+        _len = r;
+        return r > 0;
+    }
+
+    int                 _fd;
+    std::vector<char>   _buf;
+    size_t              _pos, _len;
+};
+
+class key_writer
+{
+public:
+    key_writer(const std::string & path, size_t buf_bytes) : _path(path), _len(0), _count(0)
+    {
+        _buf.resize(buf_bytes / sizeof(cube_key) * sizeof(cube_key));
+        _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(_fd < 0) { perror(path.c_str()); exit(1); }
+    }
+    ~key_writer() { flush(); ::close(_fd); }
+
+    void put(const cube_key & k)
+    {
+        if(_len == _buf.size()) flush();
+        memcpy(&_buf[_len], &k, sizeof(k));
+        _len += sizeof(k);
+        _count++;
+    }
+
+    // large arrays skip the buffer
+    void put(const cube_key * k, size_t n)
+    {
+        flush();
+        write_all((const char *)k, n * sizeof(cube_key));
+        _count += n;
+    }
+
+    size_t count() const { return _count; }
+
+private:
+    void flush()
+    {
+        write_all(&_buf[0], _len);
+        _len = 0;
+    }
+    void write_all(const char * p, size_t n)
+    {
+        while(n > 0) {
+            ssize_t w = ::write(_fd, p, n);
+            if(w < 0) { perror(_path.c_str()); exit(1); }
+            p += w;
+            n -= w;
+        }
+    }
+
+    std::string         _path;
+    int                 _fd;
+    std::vector<char>   _buf;
+    size_t              _len, _count;
+};
+
+static std::string ddd_path(const std::string & dir, const char * what, int depth, int run = -1)
+{
+    char name[64];
+    if(run < 0) snprintf(name, sizeof(name), "/tcube_%s_%02d.bin", what, depth);
+    else        snprintf(name, sizeof(name), "/tcube_%s_%02d_%04d.bin", what, depth, run);
+    return dir + name;
+}
+
+// k-way merge of the sorted files in into out, duplicates & keys in any of
+// the sorted files in skip are dropped. return: keys read
+static size_t ddd_merge(const std::vector<std::string> & in, const std::vector<std::string> & skip,
+                        key_writer & out, size_t buf)
+{
+    typedef std::pair<cube_key, int> head;
+    struct later { bool operator()(const head & a, const head & b) const { return b.first < a.first; } };
+    std::priority_queue<head, std::vector<head>, later> heap;
+    std::vector<key_reader *> run(in.size()), sk(skip.size());
+    std::vector<cube_key> sk_key(skip.size());
+    std::vector<bool> sk_has(skip.size());
+    size_t rd = 0;
+
+    for(size_t r=0;r<in.size();r++) {
+        run[r] = new key_reader(in[r], buf);
+        head h;
+        h.second = r;
+        if(run[r]->next(h.first)) heap.push(h);
+    }
+    for(size_t j=0;j<skip.size();j++) {
+        sk[j] = new key_reader(skip[j], buf);
+        sk_has[j] = sk[j]->next(sk_key[j]);
+    }
+
+    cube_key last = {0, 0};
+    bool has_last = false;
+    while(!heap.empty()) {
+        head h = heap.top();
+        cube_key k = h.first;
+        heap.pop();
+        rd++;
+        if(run[h.second]->next(h.first)) heap.push(h);
+
+        if(has_last && k == last) continue;
+        has_last = true;
+        last = k;
+
+        bool dup = false;
+        for(size_t j=0;j<skip.size();j++) {
+            while(sk_has[j] && sk_key[j] < k) { sk_has[j] = sk[j]->next(sk_key[j]); rd++; }
+            dup = dup || (sk_has[j] && sk_key[j] == k);
+        }
+        if(!dup) out.put(k);
+    }
+
+    for(size_t r=0;r<run.size();r++) delete run[r];
+    for(size_t j=0;j<sk.size();j++) delete sk[j];
+    return rd;
+}
+
+static int ddd_main(const std::string & dir, int max_depth, size_t mem_bytes, const std::vector<int> & moves, bool sym)
+{
+    // half of the budget collects successors, the other half is I/O buffers
+    // of io_buf each: a merge has fan_in runs + 2 skip levels open plus the
+    // output, the expansion the level, the batch & a run. runs are merged at
+    // most fan_in at a time (fds & buffers), more than that takes extra
+    // passes, so a small budget means more passes rather than more memory
+    mem_bytes = std::max<size_t>(mem_bytes, 1 << 20);
+    const size_t io = mem_bytes / 2;
+    const size_t fan_in = std::min<size_t>(256, std::max<size_t>(2, io / (64 << 10) - 3));
+    const size_t io_buf = std::min<size_t>(4 << 20, std::max<size_t>(4 << 10, io / (fan_in + 3)));
+    const size_t piece = std::max<size_t>(io / sizeof(cube_key), MOVE_BATCH * moves.size());
+    std::vector<cube_key> succ;
+    cube c[MOVE_BATCH];
+    std::vector<cube> kids(MOVE_BATCH * moves.size());
+    std::vector<cube_key> batch(io_buf / sizeof(cube_key) + 1);
+
+    cube root;
+    root.reset();
+    root.init_peer_off();
+    {
+        key_writer w(ddd_path(dir, "level", 0), io_buf);
+        w.put(root.key());
+    }
+
+    size_t acting = 1, total = 1;
+    printf("depth     acting      fixed  positions    time(s)    nodes/s  runs  MB read  MB write\n");
+    for(int depth = 0; depth <= max_depth && acting > 0; depth++)
+    {
+        double t0 = now_sec();
+        size_t rd = 0, wr = 0, positions = 0;
+        int nrun = 0;
+        std::vector<std::string> runs;
+
+        auto write_run = [&]() {
+            std::sort(succ.begin(), succ.end());
+            succ.erase(std::unique(succ.begin(), succ.end()), succ.end());
+            runs.push_back(ddd_path(dir, "run", depth + 1, nrun++));
+            key_writer w(runs.back(), io_buf);
+            w.put(&succ[0], succ.size());
+            wr += succ.size();
+            succ.clear();
+        };
+
+        // expand the level into sorted runs
+        {
+            key_reader in(ddd_path(dir, "level", depth), io_buf);
+            size_t n;
+            succ.reserve(std::min(piece, acting * moves.size()));
+            while((n = in.next(&batch[0], batch.size())) > 0) {
+                rd += n;
+                for(size_t k0=0;k0<n;k0+=MOVE_BATCH) {
+                    size_t nb = std::min<size_t>(MOVE_BATCH, n - k0);
+                    for(size_t k=0;k<nb;k++) c[k].set(batch[k0 + k]);
+                    cube::move_batch(c, nb, &moves[0], moves.size(), &kids[0]);
+                    for(size_t i=0;i<nb*moves.size();i++) {
+                        if(sym) {
+                            cube canon;
+                            kids[i].canonical(canon);
+                            succ.push_back(canon.key());
+                        } else {
+                            succ.push_back(kids[i].key());
+                        }
+                    }
+                    if(sym) {
+                        for(size_t k=0;k<nb;k++) {
+                            cube canon;
+                            int stab;
+                            c[k].canonical(canon, &stab);
+                            positions += 48 / stab;
+                        }
+                    } else {
+                        positions += nb;
+                    }
+                    if(succ.size() + MOVE_BATCH * moves.size() > piece)
+                        write_run();
+                }
+            }
+            if(succ.size())
+                write_run();
+            std::vector<cube_key>().swap(succ);
+        }
+        int runs_written = nrun;
+
+        // too many runs, merge them into fewer longer ones
+        while(runs.size() > fan_in) {
+            std::vector<std::string> merged;
+            for(size_t r0=0;r0<runs.size();r0+=fan_in) {
+                std::vector<std::string> group(runs.begin() + r0, runs.begin() + std::min(r0 + fan_in, runs.size()));
+                merged.push_back(ddd_path(dir, "run", depth + 1, nrun++));
+                key_writer w(merged.back(), io_buf);
+                rd += ddd_merge(group, std::vector<std::string>(), w, io_buf);
+                wr += w.count();
+                for(size_t r=0;r<group.size();r++) unlink(group[r].c_str());
+            }
+            runs.swap(merged);
+        }
+
+        // last merge drops what's in level d or d-1
+        size_t found;
+        {
+            std::vector<std::string> skip;
+            skip.push_back(ddd_path(dir, "level", depth));
+            if(depth > 0) skip.push_back(ddd_path(dir, "level", depth - 1));
+            key_writer out(ddd_path(dir, "level", depth + 1), io_buf);
+            rd += ddd_merge(runs, skip, out, io_buf);
+            for(size_t r=0;r<runs.size();r++) unlink(runs[r].c_str());
+            found = out.count();
+            wr += found;
+        }
+        if(depth > 0)
+            unlink(ddd_path(dir, "level", depth - 1).c_str());
+
+        double dt = now_sec() - t0;
+        printf("%5d %10zu %10zu %10zu %10.3f %10.0f %5d %8.1f %9.1f\n",
+                depth, acting, total, positions, dt, acting / dt, runs_written,
+                rd * sizeof(cube_key) / 1048576.0, wr * sizeof(cube_key) / 1048576.0);
+        fflush(stdout);
+
+        acting = found;
+        total += found;
+    }
+    printf("levels are in %s\n", dir.c_str());
+    return 0;
+}
+
+//=====================================================================
+// pattern databases & IDA*
+//
+// the search runs on cubie positions: a move sends every corner (slot,
+// twist) & edge (slot, flip) through a 24 x 18 table, derived from the
+// facelet moves. a pattern is a subset of the cubies, its database holds
+// the HTM distance to solve just them, 4 bits per entry in a file that
+// is mapped in. the heuristic is the max over the corners & two sets of
+// 6 edges, which never overestimates.
+
+struct cubie_moves
+{
+    uint8_t corner[24][18];
+    uint8_t edge[24][18];
+
+    void init()
+    {
+        cube c;
+        uint8_t cpos[8], epos[12];
+        for(int m=0;m<18;m++) {
+            c.reset();
+            c.move(m);
+            c.cubies(cpos, epos);
+            // what was solved in slot x moved to cpos[x], twists add up
+            for(int x=0;x<8;x++)
+                for(int t=0;t<3;t++) corner[x*3 + t][m] = cpos[x]/3*3 + (cpos[x]%3 + t) % 3;
+            for(int x=0;x<12;x++)
+                for(int f=0;f<2;f++) edge[x*2 + f][m] = epos[x]/2*2 + (epos[x]%2 + f) % 2;
+        }
+
+        // must agree with the facelets on any state
+        cube r;
+        r.reset();
+        for(int i=0;i<200;i++) {
+            uint8_t c0[8], e0[12], c1[8], e1[12];
+            int m = (i*7 + i/5) % 18;
+            r.cubies(c0, e0);
+            r.move(m);
+            r.cubies(c1, e1);
+            for(int x=0;x<8;x++)  if(corner[c0[x]][m] != c1[x]) { fprintf(stderr, "corner table broken\n"); abort(); }
+            for(int x=0;x<12;x++) if(edge[e0[x]][m] != e1[x])   { fprintf(stderr, "edge table broken\n"); abort(); }
+        }
+    }
+};
+static cubie_moves g_cubie_moves;
+
+struct pdb_pattern
+{
+    const char *    name;
+    bool            corner;     // else edges
+    int             first;      // cubies first .. first+count-1
+    int             count;
+
+    int slots() const       { return corner ? 8 : 12; }
+    int mod() const         { return corner ? 3 : 2; }
+    // the last twist is implied for the full corner set
+    size_t orients() const  { return corner ? 2187 : (size_t)1 << count; }
+    size_t entries() const
+    {
+        size_t n = 1;
+        for(int j=0;j<count;j++) n *= slots() - j;
+        return n * orients();
+    }
+
+    size_t rank(const uint8_t * pos) const
+    {
+        uint32_t used = 0;
+        size_t r = 0, o = 0;
+        for(int j=0;j<count;j++) {
+            int slot = pos[j] / mod();
+            r = r * (slots() - j) + __builtin_popcount(~used & ((1u << slot) - 1));
+            used |= 1u << slot;
+            if(!corner || j < count - 1) o = o * mod() + pos[j] % mod();
+        }
+        return r * orients() + o;
+    }
+
+    void unrank(size_t idx, uint8_t * pos) const
+    {
+        size_t o = idx % orients(), r = idx / orients();
+        int digit[12], ori[12], sum = 0;
+        for(int j=count-1;j>=0;j--) {
+            digit[j] = r % (slots() - j);
+            r /= slots() - j;
+        }
+        for(int j=count-1-(corner?1:0);j>=0;j--) {
+            ori[j] = o % mod();
+            o /= mod();
+            sum += ori[j];
+        }
+        if(corner) ori[count-1] = (3 - sum%3) % 3;
+        uint32_t left = (1u << slots()) - 1;
+        for(int j=0;j<count;j++) {
+            int slot = cube::nth_bit(left, digit[j]);
+            left &= ~(1u << slot);
+            pos[j] = slot * mod() + ori[j];
+        }
+    }
+};
+
+static const pdb_pattern pdb_patterns[] = {
+    {"corner",  true,   0,  8},     // 8!*3^7     = 88179840, 42 MB
+    {"edge0",   false,  0,  6},     // 12!/6!*2^6 = 42577920, 20 MB
+    {"edge1",   false,  6,  6},
+};
+enum { PDB_COUNT = sizeof(pdb_patterns)/sizeof(pdb_patterns[0]) };
+
+struct pdb_header
+{
+    char        magic[8];       // "TCUBEPDB"
+    uint64_t    entries;
+    uint32_t    complete;
+    uint32_t    max_depth;
+    char        pad[4096 - 24];
+};
+
+class pdb
+{
+public:
+    pdb() : _map(NULL), _size(0), _tab(NULL) {}
+    ~pdb() { if(_map) munmap(_map, _size); }
+
+    // map dir/tcube_pdb_<name>.bin, build it first if it isn't there
+    bool open(const std::string & dir, const pdb_pattern & p, int nthreads)
+    {
+        _pat = p;
+        std::string path = dir + "/tcube_pdb_" + p.name + ".bin";
+        _size = sizeof(pdb_header) + (p.entries() + 1) / 2;
+
+        // a file of another size (build killed before ftruncate, or not
+        // ours) would fault past its end, rebuild it instead
+        int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if(fd >= 0 && (fstat(fd, &st) != 0 || (size_t)st.st_size != _size)) {
+            ::close(fd);
+            fd = -1;
+        }
+        if(fd >= 0) {
+            _map = mmap(NULL, _size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            const pdb_header * h = (const pdb_header *)_map;
+            if(_map != MAP_FAILED && memcmp(h->magic, "TCUBEPDB", 8) == 0 && h->entries == p.entries() && h->complete) {
+                _tab = (uint8_t *)_map + sizeof(pdb_header);
+                printf("pdb %-8s %10zu entries, max %u, mapped from %s\n", p.name, p.entries(), h->max_depth, path.c_str());
+                return true;
+            }
+            if(_map != MAP_FAILED) munmap(_map, _size);
+            _map = NULL;
+        }
+        return build(path, nthreads);
+    }
+
+    int get(size_t i) const { return (_tab[i >> 1] >> ((i & 1) * 4)) & 0xF; }
+    int get(const uint8_t * pos) const { return get(_pat.rank(pos + _pat.first)); }
+
+private:
+    bool claim(size_t i, int d)
+    {
+        uint8_t * b = _tab + (i >> 1);
+        int sh = (i & 1) * 4;
+        uint8_t old = __atomic_load_n(b, __ATOMIC_RELAXED);
+        while(((old >> sh) & 0xF) == 0xF) {
+            uint8_t v = (old & ~(0xF << sh)) | (d << sh);
+            if(__atomic_compare_exchange_n(b, &old, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                return true;
+        }
+        return false;
+    }
+
+    // level synchronous BFS over the index space, the table is the
+    // visited set (0xF = not seen yet); threads take chunks of indices
+    bool build(const std::string & path, int nthreads)
+    {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0 || ftruncate(fd, _size) < 0) { perror(path.c_str()); return false; }
+        _map = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(_map == MAP_FAILED) { perror("mmap"); _map = NULL; return false; }
+        pdb_header * h = (pdb_header *)_map;
+        _tab = (uint8_t *)_map + sizeof(pdb_header);
+        memset(_tab, 0xFF, _size - sizeof(pdb_header));
+
+        const size_t n = _pat.entries(), chunk = 1 << 16;
+        uint8_t pos[12];
+        for(int j=0;j<_pat.count;j++) pos[j] = (_pat.first + j) * _pat.mod();
+        claim(_pat.rank(pos), 0);
+
+        printf("building pdb %s, %zu entries\n", _pat.name, n);
+        size_t total = 1, found = 1;
+        int depth = 0;
+        for(; found > 0 && depth < 14; depth++) {
+            double t0 = now_sec();
+            std::atomic<size_t> next(0), level_found(0);
+            auto scan = [&]() {
+                const uint8_t (*tab)[18] = _pat.corner ? g_cubie_moves.corner : g_cubie_moves.edge;
+                size_t mine = 0;
+                uint8_t p[12], q[12];
+                for(size_t i0; (i0 = next.fetch_add(chunk)) < n; ) {
+                    for(size_t i=i0;i<std::min(i0 + chunk, n);i++) {
+                        if(((__atomic_load_n(_tab + (i >> 1), __ATOMIC_RELAXED) >> ((i & 1) * 4)) & 0xF) != depth)
+                            continue;
+                        _pat.unrank(i, p);
+                        for(int m=0;m<18;m++) {
+                            for(int j=0;j<_pat.count;j++) q[j] = tab[p[j]][m];
+                            if(claim(_pat.rank(q), depth + 1)) mine++;
+                        }
+                    }
+                }
+                level_found += mine;
+            };
+            std::vector<std::thread> th;
+            for(int t=1;t<nthreads;t++) th.emplace_back(scan);
+            scan();
+            for(auto & t : th) t.join();
+            found = level_found;
+            total += found;
+            printf("  depth %2d -> %10zu new, %10zu/%zu  %.1f s\n", depth, found, total, n, now_sec() - t0);
+            fflush(stdout);
+        }
+
+        memcpy(h->magic, "TCUBEPDB", 8);
+        h->entries = n;
+        h->max_depth = depth - 1;
+        h->complete = total == n;
+        msync(_map, _size, MS_SYNC);
+        if(!h->complete) {
+            fprintf(stderr, "pdb %s: %zu of %zu entries reached\n", _pat.name, total, n);
+            return false;
+        }
+        return true;
+    }
+
+    pdb_pattern _pat;
+    void *      _map;
+    size_t      _size;
+    uint8_t *   _tab;
+};
 
-int main()
+// face letters of move_name(): faces 0..5, the opposite pairs are U-D, L-R, F-B
+static const char face_letter[] = "ULFRDB";
+
+static std::string move_name(int m)
+{
+    std::string s(1, face_letter[m/3]);
+    if(m%3 == 1) s += "2";
+    if(m%3 == 2) s += "'";
+    return s;
+}
+
+// "U R2 F' ..." -> moves, return: false on a bad token
+static bool parse_moves(const char * text, std::vector<int> & moves)
+{
+    moves.clear();
+    for(const char * p = text; *p; ) {
+        if(*p == ' ') { p++; continue; }
+        const char * f = strchr(face_letter, *p);
+        if(!f || !*f) return false;
+        int m = (f - face_letter) * 3;
+        p++;
+        if(*p == '2') m += 1, p++;
+        else if(*p == '\'') m += 2, p++;
+        moves.push_back(m);
+    }
+    return true;
+}
+
+class ida_solver
+{
+public:
+    ida_solver(const pdb * tabs) : _pdb(tabs), _prune(all_moves(), true) {}
+
+    uint64_t nodes;
+
+    // return: optimal HTM solution of the state, or false if it's longer than max_len
+    bool solve(const cube & c, std::vector<int> & solution, int max_len = 20)
+    {
+        uint8_t cpos[8], epos[12];
+        c.cubies(cpos, epos);
+        nodes = 0;
+        for(int bound = h(cpos, epos); bound <= max_len; ) {
+            int next = 99;
+            if(dfs(cpos, epos, 0, bound, NO_MOVE, next)) {
+                solution.assign(_path, _path + bound);
+                return true;
+            }
+            bound = next;
+        }
+        return false;
+    }
+
+private:
+    static std::vector<int> all_moves()
+    {
+        std::vector<int> m;
+        move_set("htm", m);
+        return m;
+    }
+
+    int h(const uint8_t * cpos, const uint8_t * epos) const
+    {
+        return std::max(_pdb[0].get(cpos), std::max(_pdb[1].get(epos), _pdb[2].get(epos)));
+    }
+
+    bool dfs(const uint8_t * cpos, const uint8_t * epos, int g, int bound, int last, int & next)
+    {
+        nodes++;
+        int f = g + h(cpos, epos);
+        if(f > bound) {
+            next = std::min(next, f);
+            return false;
+        }
+        if(f == g)          // h == 0 only when solved
+            return true;
+
+        uint8_t c2[8], e2[12];
+        for(int m=0;m<18;m++) {
+            if(_prune.skip[last][m]) continue;
+            for(int x=0;x<8;x++)  c2[x] = g_cubie_moves.corner[cpos[x]][m];
+            for(int x=0;x<12;x++) e2[x] = g_cubie_moves.edge[epos[x]][m];
+            _path[g] = m;
+            if(dfs(c2, e2, g + 1, bound, m, next)) return true;
+        }
+        return false;
+    }
+
+    const pdb *     _pdb;
+    move_pruning    _prune;
+    int             _path[32];
+};
+
+/*
+ * solve scrambles with IDA*: text ("U R2 F' ...") or, without it, a fixed
+ * set of count random scrambles of len moves (same seed every run)
+ */
+static int solve_main(const std::string & dir, const char * text, int count, int len)
+{
+    int nthreads = std::thread::hardware_concurrency();
+    cube root;
+    root.reset();
+    root.init_peer_off();
+    g_cubie_moves.init();
+
+    pdb tabs[PDB_COUNT];
+    for(int i=0;i<PDB_COUNT;i++)
+        if(!tabs[i].open(dir, pdb_patterns[i], nthreads)) return 1;
+    if(count == 0) return 0;
+
+    std::vector<std::vector<int>> scrambles;
+    std::vector<int> moves;
+    if(text) {
+        if(!parse_moves(text, moves)) {
+            fprintf(stderr, "bad moves \"%s\", use %s with 2 or '\n", text, face_letter);
+            return 1;
+        }
+        scrambles.push_back(moves);
+    } else {
+        std::vector<int> all;
+        move_set("htm", all);
+        move_pruning prune(all, true);
+        srand(2019);
+        for(int i=0;i<count;i++) {
+            moves.clear();
+            int last = NO_MOVE;
+            while((int)moves.size() < len) {
+                int m = rand() % 18;
+                if(prune.skip[last][m]) continue;
+                moves.push_back(m);
+                last = m;
+            }
+            scrambles.push_back(moves);
+        }
+    }
+
+    ida_solver ida(tabs);
+    uint64_t all_nodes = 0;
+    double all_time = 0;
+    printf("  # len        nodes    time(s)    nodes/s  solution\n");
+    for(size_t i=0;i<scrambles.size();i++) {
+        cube c = root;
+        for(size_t k=0;k<scrambles[i].size();k++) c.move(scrambles[i][k]);
+
+        std::vector<int> sol;
+        double t0 = now_sec();
+        bool ok = ida.solve(c, sol);
+        double dt = now_sec() - t0;
+        all_nodes += ida.nodes;
+        all_time += dt;
+
+        // the solution must solve it
+        for(size_t k=0;k<sol.size();k++) c.move(sol[k]);
+        std::string str;
+        for(size_t k=0;k<sol.size();k++) str += (k ? " " : "") + move_name(sol[k]);
+        printf("%3zu %3d %12llu %10.3f %10.0f  %s%s\n", i, ok ? (int)sol.size() : -1,
+                (unsigned long long)ida.nodes, dt, ida.nodes / dt, str.c_str(),
+                ok && !(c == root) ? "  WRONG" : "");
+        fflush(stdout);
+    }
+    printf("total %zu scrambles, %llu nodes, %.3f s, %.0f nodes/s, %.3f s per scramble\n",
+            scrambles.size(), (unsigned long long)all_nodes, all_time, all_nodes / all_time,
+            all_time / scrambles.size());
+    return 0;
+}
+
+//=====================================================================
+// bidirectional BFS between two states
+//
+// each side keeps its nodes (state, parent node, move) in the order they
+// were found, so its frontier is the tail of that array, and a cube_map
+// from state to node. the side with the smaller frontier expands a whole
+// level, every state it reaches is looked up in the other side; once
+// they meet the level is finished & the shortest meeting wins.
+// the backward side turns the inverse moves, so its back-pointers read
+// forward: node --move--> parent --move--> ... --> target.
+
+struct path_node
+{
+    cube_key    key;
+    uint32_t    parent;
+    uint8_t     move;
+} __attribute__((packed));
+
+struct path_side
 {
+    std::vector<path_node>  node;
+    cube_map                seen;
+    size_t                  level_begin;
+    int                     depth;
+
+    void start(const cube & c)
+    {
+        path_node n = {c.key(), ~0u, NO_MOVE};
+        node.push_back(n);
+        seen.insert(n.key, 0);
+        level_begin = 0;
+        depth = 0;
+    }
+    size_t frontier() const { return node.size() - level_begin; }
+};
+
+// return: false if there is no path within max_len
+static bool bidir_search(const cube & from, const cube & to, const std::vector<int> & moves,
+                         int max_len, std::vector<int> & path)
+{
+    path_side side[2];
+    side[0].start(from);
+    side[1].start(to);
+
+    // backward turns inverse moves, records the forward one
+    std::vector<int> inv(moves.size());
+    for(size_t i=0;i<moves.size();i++) inv[i] = moves[i]/3*3 + 2 - moves[i]%3;
+
+    uint32_t meet[2] = {0, 0};
+    if(from == to) {
+        path.clear();
+        return true;
+    }
+
+    printf("side depth   frontier    visited    time(s)    nodes/s       MB\n");
+    while(side[0].depth + side[1].depth < max_len) {
+        int d = side[0].frontier() <= side[1].frontier() ? 0 : 1;
+        path_side & me = side[d];
+        const path_side & other = side[1-d];
+        const std::vector<int> & mv = d == 0 ? moves : inv;
+        size_t begin = me.level_begin, end = me.node.size();
+        int best = max_len + 1;
+        double t0 = now_sec();
+
+        if(begin == end) return false;      // the whole space is explored
+        cube c[MOVE_BATCH];
+        std::vector<cube> kids(MOVE_BATCH * mv.size());
+        for(size_t k0=begin;k0<end;k0+=MOVE_BATCH) {
+            size_t n = std::min<size_t>(MOVE_BATCH, end - k0);
+            for(size_t k=0;k<n;k++) c[k].set(me.node[k0 + k].key);
+            cube::move_batch(c, n, &mv[0], mv.size(), &kids[0]);
+
+            for(size_t i=0;i<n*mv.size();i++) {
+                path_node pn = {kids[i].key(), (uint32_t)(k0 + i / mv.size()), (uint8_t)moves[i % mv.size()]};
+                if(!me.seen.insert(pn.key, me.node.size())) continue;
+                me.node.push_back(pn);
+
+                uint32_t o;
+                if(other.seen.find(pn.key, o)) {
+                    // depth of o on the other side: walk its parents
+                    int od = 0;
+                    for(uint32_t x = o; other.node[x].parent != ~0u; x = other.node[x].parent) od++;
+                    if(me.depth + 1 + od < best) {
+                        best = me.depth + 1 + od;
+                        meet[d] = me.node.size() - 1;
+                        meet[1-d] = o;
+                    }
+                }
+            }
+        }
+        me.level_begin = end;
+        me.depth++;
+
+        double dt = now_sec() - t0;
+        printf("%4s %5d %10zu %10zu %10.3f %10.0f %8.1f\n", d ? "bwd" : "fwd", me.depth,
+                me.frontier(), me.seen.size(), dt, (end - begin) / dt,
+                (me.seen.memory() + other.seen.memory() +
+                 (me.node.capacity() + other.node.capacity()) * sizeof(path_node)) / 1048576.0);
+        fflush(stdout);
+
+        if(best <= max_len) {
+            // from --> meet: forward parents, reversed
+            path.clear();
+            for(uint32_t x = meet[0]; side[0].node[x].parent != ~0u; x = side[0].node[x].parent)
+                path.push_back(side[0].node[x].move);
+            std::reverse(path.begin(), path.end());
+            // meet --> to: backward parents, in order
+            for(uint32_t x = meet[1]; side[1].node[x].parent != ~0u; x = side[1].node[x].parent)
+                path.push_back(side[1].node[x].move);
+            printf("visited %zu + %zu states\n", side[0].seen.size(), side[1].seen.size());
+            return true;
+        }
+    }
+    return false;
+}
+
+static int path_main(const char * from_text, const char * to_text, const char * metric, int max_len)
+{
+    std::vector<int> moves, a, b;
+    if(!move_set(metric, moves)) {
+        fprintf(stderr, "unknown move set %s\n", metric);
+        return 1;
+    }
+    if(!parse_moves(from_text, a) || !parse_moves(to_text, b)) {
+        fprintf(stderr, "bad moves, use %s with 2 or '\n", face_letter);
+        return 1;
+    }
+
+    cube from, to;
+    from.reset();
+    from.init_peer_off();
+    to = from;
+    for(size_t i=0;i<a.size();i++) from.move(a[i]);
+    for(size_t i=0;i<b.size();i++) to.move(b[i]);
+
+    std::vector<int> path;
+    double t0 = now_sec();
+    if(!bidir_search(from, to, moves, max_len, path)) {
+        printf("no path within %d moves\n", max_len);
+        return 1;
+    }
+    double dt = now_sec() - t0;
+
+    cube c = from;
+    std::string str;
+    for(size_t i=0;i<path.size();i++) {
+        c.move(path[i]);
+        str += (i ? " " : "") + move_name(path[i]);
+    }
+    printf("%zu moves in %.3f s: %s%s\n", path.size(), dt, str.c_str(), c == to ? "" : "  WRONG");
+    return c == to ? 0 : 1;
+}
+
+// moves/sec of rotate_face() & of every move kernel, batches of
+// MOVE_BATCH states x 18 moves, plus key() & set() for comparison
+static int move_bench(size_t states)
+{
+    cube root;
+    root.reset();
+    root.init_peer_off();
+
+    std::vector<cube> st(states);
+    srand(1);
+    for(size_t i=0;i<states;i++) {
+        st[i] = root;
+        for(int k=0;k<25;k++) st[i].rotate_face(rand() % 6);
+    }
+    int all[18];
+    for(int m=0;m<18;m++) all[m] = m;
+    std::vector<cube> kids(MOVE_BATCH * 18);
+    unsigned sum = 0;       // keeps the work alive
+
+    double t0 = now_sec();
+    for(size_t i=0;i<states;i++)
+        for(int m=0;m<18;m++) {
+            cube n = st[i];
+            for(int q=0;q<=m%3;q++) n.rotate_face(m/3);
+            sum += n.s[m];
+        }
+    double dt = now_sec() - t0;
+    printf("%-12s %8.1f M moves/s\n", "rotate_face", states * 18 / dt * 1e-6);
+
+    const struct { const char * name; cube_move_fn fn; } kernels[] = {
+        {"scalar", move_batch_scalar}, {"ssse3", move_batch_ssse3}, {"vbmi", move_batch_vbmi},
+    };
+    for(size_t k=0;k<sizeof(kernels)/sizeof(kernels[0]);k++) {
+        if(k == 2 && !(__builtin_cpu_supports("avx512vbmi") && __builtin_cpu_supports("avx512bw"))) continue;
+        t0 = now_sec();
+        for(size_t i=0;i<states;i+=MOVE_BATCH) {
+            size_t n = std::min<size_t>(MOVE_BATCH, states - i);
+            kernels[k].fn(&st[i], n, all, 18, &kids[0]);
+            sum += kids[n*18 - 1].s[i % 48];
+        }
+        dt = now_sec() - t0;
+        printf("%-12s %8.1f M moves/s%s\n", kernels[k].name, states * 18 / dt * 1e-6,
+                strcmp(kernels[k].name, cube::move_kernel) == 0 ? "  (used)" : "");
+    }
+
+    std::vector<cube_key> keys(states);
+    t0 = now_sec();
+    for(size_t i=0;i<states;i++) keys[i] = st[i].key();
+    dt = now_sec() - t0;
+    printf("%-12s %8.1f M/s\n", "key()", states / dt * 1e-6);
+    t0 = now_sec();
+    for(size_t i=0;i<states;i++) { cube c; c.set(keys[i]); sum += c.s[i % 48]; }
+    dt = now_sec() - t0;
+    printf("%-12s %8.1f M/s\n", "set()", states / dt * 1e-6);
+    return sum == 0x12345678;
+}
+
+/*
+ * tcube [max_depth] [threads] [cw|qtm|htm] [sym]
+ * tcube ddd <dir> [max_depth] [mem_MB] [qtm|htm] [sym]
+ * tcube bench [states]
+ * tcube pdb [dir]
+ * tcube solve <dir> ["moves" | count [len]]
+ * tcube path "from moves" ["to moves"] [cw|qtm|htm] [max_len]
+ *
+ * env TCUBE_KERNEL=vbmi|ssse3|scalar forces the move kernel.
+ *
+ * breadth first enumeration of the states reachable from the solved cube,
+ * frontiers and the visited set hold cube_key (9 & 8 bytes per state).
+ * ddd keeps the levels in files under dir instead, memory stays within
+ * mem_MB (default 1024, at least 1) however deep it goes, plus ~100 KB of
+ * fixed tables & cube batches.
+ *
+ * level synchronous: every thread appends the new states it finds to its
+ * own part of the next frontier, the parts are cut into chunks that the
+ * threads take from a shared counter when expanding the next level.
+ *
+ * sym: a state stands for its class under the 48 symmetries, only the
+ * canonical one is stored (needs qtm|htm, a mirror turns cw into ccw).
+ * acting & fixed count classes then, positions the states they stand for.
+ * moves are pruned with move_pruning, from the last move that reached a
+ * state; the opposite face ordering only without sym, since the last move
+ * of a canonical state is conjugated and the face order isn't kept.
+ */
+int main(int argc, char * argv[])
+{
+	std::vector<int> moves;
+
+	if(argc > 1 && strcmp(argv[1], "bench") == 0)
+		return move_bench(argc > 2 ? atoi(argv[2]) : 1000000);
+
+	// pattern databases are built once into dir, then mapped
+	if(argc > 1 && strcmp(argv[1], "pdb") == 0)
+		return solve_main(argc > 2 ? argv[2] : ".", NULL, 0, 0);
+
+	// shortest sequence between two states, both given as moves from solved
+	if(argc > 2 && strcmp(argv[1], "path") == 0)
+		return path_main(argv[2], argc > 3 ? argv[3] : "", argc > 4 ? argv[4] : "htm", argc > 5 ? atoi(argv[5]) : 20);
+
+	if(argc > 2 && strcmp(argv[1], "solve") == 0) {
+		if(argc > 3 && !isdigit((unsigned char)argv[3][0]))
+			return solve_main(argv[2], argv[3], 1, 0);
+		return solve_main(argv[2], NULL, argc > 3 ? atoi(argv[3]) : 10, argc > 4 ? atoi(argv[4]) : 12);
+	}
+
+	if(argc > 2 && strcmp(argv[1], "ddd") == 0) {
+		int max_depth = argc > 3 ? atoi(argv[3]) : 100;
+		size_t mem_mb = argc > 4 ? atoi(argv[4]) : 1024;
+		const char * metric = argc > 5 ? argv[5] : "htm";
+		if(strcmp(metric, "cw") == 0 || !move_set(metric, moves)) {
+			fprintf(stderr, "ddd needs a move set closed under inverse: qtm or htm\n");
+			return 1;
+		}
+		return ddd_main(argv[2], max_depth, mem_mb << 20, moves, argc > 6 && strcmp(argv[6], "sym") == 0);
+	}
+
+	int max_depth = argc > 1 ? atoi(argv[1]) : 100;
+	int nthreads = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+	if(nthreads < 1) nthreads = 1;
+	if(!move_set(argc > 3 ? argv[3] : "cw", moves)) {
+		fprintf(stderr, "unknown move set %s\n", argv[3]);
+		return 1;
+	}
+	bool sym = argc > 4 && strcmp(argv[4], "sym") == 0;
+	if(sym && moves.size() == 6) {
+		fprintf(stderr, "sym needs qtm or htm\n");
+		return 1;
+	}
+	move_pruning prune(moves, !sym);
+
 	cube root;
 	root.reset();
 	root.init_peer_off();
 
-	std::set<cube> node_fixed;
-	std::vector<cube> node_act[2];
+	struct chunk { int part; size_t k0, k1; };
+	const size_t chunk_size = 4096;
+
+	// frontier entry: the state & the move that reached it
+	struct node {
+		cube_key	key;
+		uint8_t		last;
+	} __attribute__((packed));
+
+	cube_set_mt * node_fixed = new cube_set_mt;
+	std::vector<std::vector<node>> node_act[2];
+	std::vector<chunk> chunks;
+	std::vector<size_t> positions(nthreads), pruned(nthreads);
 	int actid = 0;
 	int depth = 0;
-	node_act[actid].push_back(root);
-
-	while(node_act[actid].size() > 0)
+	node_act[0].resize(nthreads);
+	node_act[1].resize(nthreads);
+	node rn = {root.key(), NO_MOVE};
+	node_act[actid][0].push_back(rn);
+	node_fixed->insert(root.key());
+
+	printf("%d threads, %s move kernel, %zu moves%s\n", nthreads, cube::move_kernel, moves.size(), sym ? ", 48 symmetries" : "");
+	printf("depth     acting      fixed  positions  pruned    time(s)    nodes/s       MB\n");
+	for(;;)
 	{
 		auto & na_cur = node_act[actid];
 		auto & na_next = node_act[1-actid];
-
-		na_next.clear();
-
-		printf("depth:%2d acting:%8d fixed:%8d\n",
-				depth, na_cur.size(), node_fixed.size());
-
-		for(int k=0;k<na_cur.size();k++)
-		{
-			cube &c = na_cur[k];
-
-			//derived it
-			node_fixed.insert(c);
-
-			for(int i=0;i<6;i++)
-			{
-				cube n = c;
-				n.rotate_face(i);
-
-				if(node_fixed.find(n) == node_fixed.end()){
-					node_fixed.insert(n);
-					na_next.push_back(n);
+		double t0 = now_sec();
+
+		size_t acting = 0;
+		chunks.clear();
+		for(int t=0;t<nthreads;t++) {
+			for(size_t k=0;k<na_cur[t].size();k+=chunk_size) {
+				chunk c = {t, k, std::min(k + chunk_size, na_cur[t].size())};
+				chunks.push_back(c);
+			}
+			acting += na_cur[t].size();
+		}
+		if(acting == 0 || depth > max_depth) break;
+
+		std::atomic<size_t> next_chunk(0);
+		auto expand = [&](int t) {
+			std::vector<node> & local = na_next[t];
+			cube c[MOVE_BATCH];
+			std::vector<cube> kids(MOVE_BATCH * moves.size());
+			local.clear();
+			positions[t] = pruned[t] = 0;
+			for(size_t j; (j = next_chunk++) < chunks.size(); ) {
+				const std::vector<node> & part = na_cur[chunks[j].part];
+				for(size_t k0=chunks[j].k0;k0<chunks[j].k1;k0+=MOVE_BATCH)
+				{
+					size_t n = std::min<size_t>(MOVE_BATCH, chunks[j].k1 - k0);
+					for(size_t k=0;k<n;k++) c[k].set(part[k0 + k].key);
+					cube::move_batch(c, n, &moves[0], moves.size(), &kids[0]);
+
+					for(size_t i=0;i<n*moves.size();i++)
+					{
+						int m = moves[i % moves.size()];
+						if(prune.skip[part[k0 + i / moves.size()].last][m]) {
+							pruned[t]++;
+							continue;
+						}
+						node nn;
+						if(sym) {
+							cube canon;
+							int k = kids[i].canonical(canon);
+							nn.key = canon.key();
+							nn.last = cube::syms.move[k][m];
+						} else {
+							nn.key = kids[i].key();
+							nn.last = m;
+						}
+						if(node_fixed->insert(nn.key))
+							local.push_back(nn);
+					}
+
+					for(size_t k=0;k<n;k++) {
+						int stab = 48;
+						cube canon;
+						if(sym) c[k].canonical(canon, &stab);
+						positions[t] += 48 / stab;
+					}
 				}
 			}
-
-			if((k & 0xF) == 0)
-				printf("%.2f%%    \r", (float)k*100/node_act[actid].size());
+		};
+
+		std::vector<std::thread> th;
+		for(int t=1;t<nthreads;t++) th.emplace_back(expand, t);
+		expand(0);
+		for(auto & t : th) t.join();
+
+		// level barrier
+		double dt = now_sec() - t0;
+		size_t found = 0, pos = 0, skipped = 0, mem = node_fixed->memory();
+		for(int t=0;t<nthreads;t++) {
+			found += na_next[t].size();
+			pos += positions[t];
+			skipped += pruned[t];
+			mem += (na_cur[t].capacity() + na_next[t].capacity()) * sizeof(node);
 		}
+		printf("%5d %10zu %10zu %10zu %6.1f%% %10.3f %10.0f %8.1f\n",
+				depth, acting, node_fixed->size() - found, pos, 100.0 * skipped / (acting * moves.size()),
+				dt, acting / dt, mem / 1048576.0);
+		fflush(stdout);
+
+		// the expanded level isn't needed anymore
+		for(int t=0;t<nthreads;t++) std::vector<node>().swap(na_cur[t]);
 		actid = 1 - actid;
 		depth ++;
-
 	}
+	delete node_fixed;
+	return 0;
 }
 
 #if 0
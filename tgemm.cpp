@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <thread>
+#include <vector>
+
+#include "cpu_gemm.h"
+
+/*
+ * cpu_sgemm multi-thread scaling
+ *
+ *   tgemm [max_threads] [size ...]
+ *
+ * default sizes: 1024 (SIZE in topencl.cpp), 2048, 4096
+ * threads go 1,2,4,... up to max_threads (all cores by default),
+ * best of 3 runs is reported with speedup & parallel efficiency vs 1 thread.
+ * CPU_GEMM_AFFINITY=1 to pin threads.
+ */
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char * argv[])
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : 0;
+    if (max_threads <= 0) max_threads = std::thread::hardware_concurrency();
+    if (max_threads <= 0) max_threads = 1;
+
+    std::vector<int> sizes;
+    for (int i = 2; i < argc; i++) sizes.push_back(atoi(argv[i]));
+    if (sizes.empty()) sizes = {1024, 2048, 4096};
+
+    std::vector<int> thread_counts;
+    for (int n = 1; n < max_threads; n *= 2) thread_counts.push_back(n);
+    thread_counts.push_back(max_threads);
+
+    printf("kernel %s, %d cores\n", cpu_sgemm_kernel_name(), (int)std::thread::hardware_concurrency());
+    printf("%6s %4s | %9s %9s %8s %6s\n", "size", "thr", "sec", "GFLOPS", "speedup", "eff");
+
+    for (size_t s = 0; s < sizes.size(); s++) {
+        int M = sizes[s], N = sizes[s], K = sizes[s];
+        std::vector<float> A((size_t)M*K), B((size_t)K*N), C((size_t)M*N);
+        for (size_t i = 0; i < A.size(); i++) A[i] = (float)(i % 17) * 0.25f - 2.0f;
+        for (size_t i = 0; i < B.size(); i++) B[i] = (float)(i % 13) * 0.5f - 3.0f;
+
+        double gflop = 2.0 * M * N * K * 1e-9;
+        double base = 0;
+        for (size_t t = 0; t < thread_counts.size(); t++) {
+            cpu_sgemm_set_threads(thread_counts[t]);
+
+            // warm up: pool start, packed buffers first touch
+            cpu_sgemm(M, N, K, &A[0], M, &B[0], K, &C[0], M);
+
+            double best = 1e30;
+            for (int r = 0; r < 3; r++) {
+                double t0 = now_sec();
+                cpu_sgemm(M, N, K, &A[0], M, &B[0], K, &C[0], M);
+                double sec = now_sec() - t0;
+                if (sec < best) best = sec;
+            }
+            if (t == 0) base = best;
+
+            printf("%6d %4d | %9.4f %9.1f %8.2f %5.0f%%\n", M, thread_counts[t],
+                   best, gflop / best, base / best, 100.0 * base / best / thread_counts[t]);
+        }
+    }
+    return 0;
+}
@@ -137,7 +137,7 @@ inline ThreadPool::~ThreadPool()
         worker.join();
 }
 
-void ThreadPool::stop_all(void)
+inline void ThreadPool::stop_all(void)
 {
     {
         std::unique_lock<std::mutex> lock(queue_mutex);
@@ -4,97 +4,255 @@
 #include <thread>
 #include <mutex>
 #include <deque>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <condition_variable>
 
 
+// always-on telemetry of a blocking_queue, all fields are updated with
+// relaxed atomics so they can be sampled from any thread without the queue lock
+struct blocking_queue_stats
+{
+    // time-in-queue histogram, bucket i counts elements that stayed
+    // [2^(i-1), 2^i) microseconds in queue (bucket 0 is < 1us)
+    enum { HIST_BUCKETS = 32 };
+
+    std::atomic<uint64_t>   enqueued;
+    std::atomic<uint64_t>   dequeued;
+    std::atomic<uint64_t>   put_timeouts;
+    std::atomic<uint64_t>   get_timeouts;
+    std::atomic<uint64_t>   producer_blocked_ns;   // put() waiting for room
+    std::atomic<uint64_t>   consumer_starved_ns;   // get() waiting for data
+    std::atomic<uint64_t>   in_queue_ns;           // sum of time-in-queue
+    std::atomic<uint64_t>   in_queue_hist[HIST_BUCKETS];
+    std::atomic<int>        max_size;
+
+    blocking_queue_stats(){ reset(); }
+
+    void reset(void)
+    {
+        enqueued = 0;
+        dequeued = 0;
+        put_timeouts = 0;
+        get_timeouts = 0;
+        producer_blocked_ns = 0;
+        consumer_starved_ns = 0;
+        in_queue_ns = 0;
+        for(int i = 0; i < HIST_BUCKETS; i++) in_queue_hist[i] = 0;
+        max_size = 0;
+    }
+
+    static int hist_bucket(uint64_t ns)
+    {
+        uint64_t us = ns / 1000;
+        int b = 0;
+        while(us && b < HIST_BUCKETS - 1) { us >>= 1; b++; }
+        return b;
+    }
+
+    // upper bound (in microseconds) of the time-in-queue for given percentile (0~100)
+    uint64_t in_queue_percentile_us(double pct) const
+    {
+        uint64_t hist[HIST_BUCKETS], total = 0;
+        for(int i = 0; i < HIST_BUCKETS; i++) total += (hist[i] = in_queue_hist[i].load(std::memory_order_relaxed));
+        if(total == 0) return 0;
+
+        uint64_t target = (uint64_t)(total * pct / 100.0), acc = 0;
+        for(int i = 0; i < HIST_BUCKETS; i++) {
+            acc += hist[i];
+            if(acc >= target && acc > 0) return (uint64_t)1 << i;
+        }
+        return (uint64_t)1 << (HIST_BUCKETS - 1);
+    }
+};
+
+
 template<class T>
 class blocking_queue
 {
+    typedef std::chrono::steady_clock clock;
+    struct entry
+    {
+        T                   obj;
+        clock::time_point   t_put;
+    };
+
 public:
-	blocking_queue(int sz = 0x7FFFFFFF):_size_limit(sz), _closed(false), _max_size(0){}
+	blocking_queue(int sz = 0x7FFFFFFF):_size_limit(sz), _closed(false){}
 
     //with Filter on element(get specific element)
 	// return: true if found
 	//         false if writer is closed
     template<class FilterFunc>
     bool get(T &ret, FilterFunc filter)
+    {
+        return get_until(ret, filter, NULL);
+    }
+
+    bool get(T &ret)
+    {
+        return get(ret, [](const T &){return true;});
+    }
+
+    // same as get() but gives up after timeout
+	// return: true if found
+	//         false if timeout or writer is closed (check closed() to tell)
+    template<class Rep, class Period, class FilterFunc>
+    bool get_for(T &ret, const std::chrono::duration<Rep, Period> & timeout, FilterFunc filter)
+    {
+        clock::time_point deadline = clock::now() + timeout;
+        return get_until(ret, filter, &deadline);
+    }
+
+    template<class Rep, class Period>
+    bool get_for(T &ret, const std::chrono::duration<Rep, Period> & timeout)
+    {
+        return get_for(ret, timeout, [](const T &){return true;});
+    }
+
+    bool put(const T & obj, bool blocking = true)
+    {
+        return put_until(obj, blocking, NULL);
+    }
+
+    // return: false if queue is still full after timeout
+    template<class Rep, class Period>
+    bool put_for(const T & obj, const std::chrono::duration<Rep, Period> & timeout)
+    {
+        clock::time_point deadline = clock::now() + timeout;
+        return put_until(obj, true, &deadline);
+    }
+
+    void close(void)
+    {
+        std::unique_lock<std::mutex> lk(_m);
+        _closed = true;
+        _cv.notify_all();
+    }
+    bool closed(void){
+        std::unique_lock<std::mutex> lk(_m);
+        return _closed;
+    }
+    int size(void){
+        std::unique_lock<std::mutex> lk(_m);
+        return _q.size();
+    }
+    int max_size(void){
+        return _stats.max_size.load(std::memory_order_relaxed);
+    }
+    // lock-free telemetry
+    const blocking_queue_stats & stats(void) const {
+        return _stats;
+    }
+    void reset_stats(void){
+        _stats.reset();
+    }
+private:
+    static void add_relaxed(std::atomic<uint64_t> & v, uint64_t d)
+    {
+        v.fetch_add(d, std::memory_order_relaxed);
+    }
+    static uint64_t elapsed_ns(clock::time_point t0, clock::time_point t1)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    }
+
+    template<class FilterFunc>
+    bool get_until(T &ret, FilterFunc filter, const clock::time_point * deadline)
     {
         std::unique_lock<std::mutex> lk(_m);
 
-        typename std::deque<T>::iterator it;
-        _cv.wait(lk,
-            [this, filter, &it]
+        typename std::deque<entry>::iterator it;
+        auto ready = [this, filter, &it]
             {
                 //mutex auto relocked
                 //check from the First Input to meet FIFO requirement
                 for(it = _q.begin(); it != _q.end(); ++it)
-                    if(filter(*it)) return true;
+                    if(filter(it->obj)) return true;
 
                 //if closed & not-found, then we will never found it in the future
                 if(_closed) return true;
 
                 return false;
-            });
+            };
 
-        if(_q.size() > _max_size) _max_size = _q.size();
+        if(!ready()) {
+            clock::time_point t0 = clock::now();
+            bool ok = true;
+            if(deadline)
+                ok = _cv.wait_until(lk, *deadline, ready);
+            else
+                _cv.wait(lk, ready);
+            add_relaxed(_stats.consumer_starved_ns, elapsed_ns(t0, clock::now()));
+
+            if(!ok) {
+                add_relaxed(_stats.get_timeouts, 1);
+                return false;
+            }
+        }
 
         //nothing will found in the future
         if(it == _q.end() && _closed)  return false;
 
-        ret = *it; //copy construct the return value
+        ret = it->obj; //copy construct the return value
+        uint64_t ns = elapsed_ns(it->t_put, clock::now());
         _q.erase(it);//remove from deque
 
+        add_relaxed(_stats.dequeued, 1);
+        add_relaxed(_stats.in_queue_ns, ns);
+        add_relaxed(_stats.in_queue_hist[blocking_queue_stats::hist_bucket(ns)], 1);
+
         if(_q.size() < _size_limit)
             _cv_notfull.notify_all();
 
         return true;
     }
 
-    bool get(T &ret)
-    {
-        return get(ret, [](const T &){return true;});
-    }
-
-    bool put(const T & obj, bool blocking = true)
+    bool put_until(const T & obj, bool blocking, const clock::time_point * deadline)
     {
         std::unique_lock<std::mutex> lk(_m);
 
-        if(!blocking && _q.size() >= _size_limit)
-        	return false;
+        if(_q.size() >= _size_limit) {
+            if(!blocking)
+                return false;
+
+            auto notfull = [this]{
+                return _q.size() <_size_limit;
+            };
+            clock::time_point t0 = clock::now();
+            bool ok = true;
+            if(deadline)
+                ok = _cv_notfull.wait_until(lk, *deadline, notfull);
+            else
+                _cv_notfull.wait(lk, notfull);
+            add_relaxed(_stats.producer_blocked_ns, elapsed_ns(t0, clock::now()));
+
+            if(!ok) {
+                add_relaxed(_stats.put_timeouts, 1);
+                return false;
+            }
+        }
+
+        _q.push_back(entry{obj, clock::now()});
+        add_relaxed(_stats.enqueued, 1);
 
-        _cv_notfull.wait(lk, [this]{
-            return _q.size() <_size_limit;
-        });
+        // only writer grows the queue, and we hold the lock
+        if((int)_q.size() > _stats.max_size.load(std::memory_order_relaxed))
+            _stats.max_size.store(_q.size(), std::memory_order_relaxed);
 
-        _q.push_back(obj);
         _cv.notify_all();
 
         return true;
     }
 
-    void close(void)
-    {
-        std::unique_lock<std::mutex> lk(_m);
-        _closed = true;
-        _cv.notify_all();
-    }
-    int size(void){
-        std::unique_lock<std::mutex> lk(_m);
-        return _q.size();
-    }
-    int max_size(void){
-        return _max_size;
-    }
-private:
     int                             _size_limit;
-    std::deque<T>                   _q;
+    std::deque<entry>               _q;
     std::mutex                      _m;
     std::condition_variable        _cv;
     std::condition_variable        _cv_notfull;
-    int                            _max_size;
     bool                           _closed;
+    blocking_queue_stats           _stats;
 };
 
 #endif
-
-
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <algorithm>
+
+#include "HLog.h"
+
+/*
+ * HLog throughput & latency benchmark
+ *
+ *   tlogbench [threads] [calls_per_thread] [log_dir]
+ *
+ * every thread logs through the HLog macros, each call is timed, then
+ * per-call latency percentiles and aggregate lines/sec are reported for
+ * each backend. log lines go to /dev/null (stdout) or into log_dir (file sink),
+ * results are printed on stderr.
+ *
+ * build variants (see CMakeLists.txt):
+ *   tlogbench          text mode: stdout, async rings, mmap file sink
+ *   tlogbench_bin      HLOG_BINARY: deferred formatting, binary files
+ *                      (log_dir/tlogbench.NNN.bin, one per bin-async-file run)
+ *   tlogbench_log4cpp  USE_LOG4CPP (+ HLOG_BINARY for the binary modes over log4cpp)
+ */
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+struct bench_result
+{
+    double      wall_sec;       // from first call to all records written
+    double      call_sec;       // from first call to last call returned
+    uint64_t    calls;
+    uint64_t    dropped;        // records async-drop threw away (ring full)
+    uint64_t    p50, p90, p99, p999, max;
+};
+
+static bench_result run_threads(int nthreads, int ncalls, int level, int payload, void (*flush)(void))
+{
+    std::vector<std::vector<uint32_t>> lat(nthreads);
+    std::vector<std::thread> th;
+    std::string text(payload, 'x');
+
+    uint64_t dropped0 = HLogAsyncDropped();
+    uint64_t t0 = now_ns();
+    for(int t = 0; t < nthreads; t++) {
+        th.emplace_back([&, t]{
+            std::vector<uint32_t> & l = lat[t];
+            const char * s = text.c_str();
+            l.resize(ncalls);
+            for(int i = 0; i < ncalls; i++) {
+                uint64_t a = now_ns();
+                if(level == N_DEBUG)
+                    HDebug("bench thread %d call %d value %f payload %s", t, i, i * 0.5, s)
+                else
+                    HInfo("bench thread %d call %d value %f payload %s", t, i, i * 0.5, s)
+                l[i] = now_ns() - a;
+            }
+        });
+    }
+    for(auto & t : th) t.join();
+    uint64_t t1 = now_ns();
+    if(flush) flush();
+    uint64_t t2 = now_ns();
+
+    std::vector<uint32_t> all;
+    for(auto & l : lat) all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+
+    bench_result r;
+    size_t n = all.size();
+    r.calls = n;
+    r.dropped = HLogAsyncDropped() - dropped0;
+    r.call_sec = (t1 - t0) * 1e-9;
+    r.wall_sec = (t2 - t0) * 1e-9;
+    r.p50  = all[n * 50 / 100];
+    r.p90  = all[n * 90 / 100];
+    r.p99  = all[n * 99 / 100];
+    r.p999 = all[n * 999 / 1000];
+    r.max  = all[n - 1];
+    return r;
+}
+
+static void report(const char * mode, int nthreads, int level, int payload, const bench_result & r)
+{
+    // line rate: records that made it out (calls - dropped) per wall second
+    fprintf(stderr, "%-22s %3d %-6s %6d | %7llu %7llu %7llu %8llu %9llu | %10.0f %10.0f %9llu\n",
+            mode, nthreads, level == N_DEBUG ? "debug" : "info", payload,
+            (unsigned long long)r.p50, (unsigned long long)r.p90, (unsigned long long)r.p99,
+            (unsigned long long)r.p999, (unsigned long long)r.max,
+            r.calls / r.call_sec, (r.calls - r.dropped) / r.wall_sec, (unsigned long long)r.dropped);
+}
+
+struct bench_mode
+{
+    const char *    name;
+    void            (*setup)(void);
+    void            (*flush)(void);     // wait until everything is written, tear down
+};
+
+static std::string g_logdir = "/tmp";
+
+static void no_op(void) {}
+
+static void setup_async_block(void) { HLogStartAsync(HLOG_RING_BLOCK, 4<<20); }
+static void stop_async(void)        { HLogStopAsync(); }
+#ifndef HLOG_BINARY
+static void setup_async_drop(void)  { HLogStartAsync(HLOG_RING_DROP, 4<<20); }
+#endif
+#ifdef HLOG_BINARY
+// one file per run, so each can be checked with hlogdecode afterwards
+static void setup_binary(void)
+{
+    static int run = 0;
+    char name[32];
+    snprintf(name, sizeof(name), "/tlogbench.%03d.bin", run++);
+    HLogOpenBinary((g_logdir + name).c_str(), HLOG_RING_BLOCK, 4<<20);
+}
+#endif
+#ifndef HLOG_BINARY
+static void setup_sink(void)        { HLogOpenFileSink((g_logdir + "/tlogbench").c_str(), 256<<20); }
+static void setup_async_sink(void)  { setup_sink(); setup_async_block(); }
+static void close_sink(void)        { HLogStopAsync(); HLogCloseFileSink(); }
+#endif
+
+static const bench_mode modes[] = {
+#if defined(USE_LOG4CPP) && defined(HLOG_BINARY)
+    {"log4cpp-bin-render",  no_op,              no_op},
+    {"bin-async-text",      setup_async_block,  stop_async},
+    {"bin-async-file",      setup_binary,       stop_async},
+#elif defined(USE_LOG4CPP)
+    {"log4cpp",             no_op,              no_op},
+    {"async-drop",          setup_async_drop,   stop_async},
+    {"async-block",         setup_async_block,  stop_async},
+    {"mmap-sink",           setup_sink,         close_sink},
+    {"async-block+mmap",    setup_async_sink,   close_sink},
+#elif defined(HLOG_BINARY)
+    {"bin-sync-render",     no_op,              no_op},
+    {"bin-async-text",      setup_async_block,  stop_async},
+    {"bin-async-file",      setup_binary,       stop_async},
+#else
+    {"stdout",              no_op,              no_op},
+    {"async-drop",          setup_async_drop,   stop_async},
+    {"async-block",         setup_async_block,  stop_async},
+    {"mmap-sink",           setup_sink,         close_sink},
+    {"async-block+mmap",    setup_async_sink,   close_sink},
+#endif
+};
+
+int main(int argc, char * argv[])
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+    int ncalls = argc > 2 ? atoi(argv[2]) : 100000;
+    if(argc > 3) g_logdir = argv[3];
+    if(max_threads < 1) max_threads = 1;
+
+    const int payloads[] = {16, 128, 1024};
+
+    // keep the terminal quiet, results go to stderr
+    if(freopen("/dev/null", "w", stdout) == NULL)
+        fprintf(stderr, "cannot redirect stdout to /dev/null, expect lots of output\n");
+
+    fprintf(stderr, "%d calls per thread, latency in ns, throughput in lines/sec\n", ncalls);
+    fprintf(stderr, "%-22s %3s %-6s %6s | %7s %7s %7s %8s %9s | %10s %10s %9s\n",
+            "mode", "thr", "level", "bytes", "p50", "p90", "p99", "p99.9", "max", "call rate", "line rate", "dropped");
+
+    std::vector<int> thread_counts;
+    for(int n = 1; n < max_threads; n *= 2) thread_counts.push_back(n);
+    thread_counts.push_back(max_threads);
+
+    for(size_t m = 0; m < sizeof(modes)/sizeof(modes[0]); m++) {
+        for(size_t k = 0; k < thread_counts.size(); k++) {
+            int nthreads = thread_counts[k];
+            for(size_t p = 0; p < sizeof(payloads)/sizeof(payloads[0]); p++) {
+                // enabled level
+                HLogSetLevel(N_DEBUG | N_INFO | N_WARN | N_ERROR | N_FATAL);
+                modes[m].setup();
+                report(modes[m].name, nthreads, N_INFO, payloads[p],
+                       run_threads(nthreads, ncalls, N_INFO, payloads[p], modes[m].flush));
+            }
+
+            // disabled level costs only the mask check, payload doesn't matter
+            HLogSetLevel(N_INFO | N_WARN | N_ERROR | N_FATAL);
+            modes[m].setup();
+            report(modes[m].name, nthreads, N_DEBUG, 0,
+                   run_threads(nthreads, ncalls, N_DEBUG, 0, modes[m].flush));
+        }
+    }
+
+    return 0;
+}
@@ -2,6 +2,19 @@
 #include <stdlib.h>
 #include <CL/cl.h>
 #include <sys/time.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "cpu_gemm.h"
 
 #define ANSI_COLOR_RED     "\x1b[31m"
 #define ANSI_COLOR_GREEN   "\x1b[32m"
@@ -14,8 +27,18 @@
 const char* clutl_GetErrorString(int errorCode);
 void clutl_device_caps(cl_device_id device);
 int clutl_platform_select(int select_id,		cl_platform_id * ptr_platform_id);
-int clutl_build_program(cl_context context, 	cl_device_id device,	const char * filename,	cl_program *ptr_program);
-void run_myGEMM(cl_platform_id platform_id, const char * kernel_filename);
+int clutl_platform_find(const char * spec);
+int clutl_device_list(cl_platform_id platform_id, const char * spec, cl_device_id * devices, int max);
+int clutl_build_program(cl_context context, 	cl_device_id device,	const char * filename,	const char * options, cl_program *ptr_program);
+void run_myGEMM(cl_platform_id platform_id, const char * kernel_name, int size, int runs);
+void tune_myGEMM(cl_platform_id platform_id, const char * kernel_name, int size, int runs);
+void batch_myGEMM(cl_platform_id platform_id, const char * kernel_name, int size, int count);
+void lowp_myGEMM(cl_platform_id platform_id, int size, int runs);
+void sweep_myGEMM(cl_platform_id platform_id, const char * kernel_name, int runs);
+void multi_myGEMM(const char * kernel_name, int size, int runs);
+
+// device of the platform to run on, see clutl_device_list()
+static const char * g_device_spec = NULL;
 #define clutl_CheckError(errorCode) \
     if (errorCode != 0) {\
         fprintf(stderr, ">>> **** %s:%d  %s\n",__FILE__,__LINE__, clutl_GetErrorString(errorCode));\
@@ -25,9 +48,39 @@ void run_myGEMM(cl_platform_id platform_id, const char * kernel_filename);
 void matmult(float *A, float *B, float * C, int M, int K, int N);
 int matcmp(float *A, float *B, int M, int N);
 double gettime_sec(void);
-int load_bin(const char *filename, void * data, int size);
-int save_bin(const char *filename, void * data, int size);
 
+// Repeat all kernels multiple times to get an average timing result
+#define NUM_RUNS 10
+
+// Size of the matrices - K, M, N (squared)
+#define SIZE (4096/4)
+
+/*
+ * topencl [platform] [kernel|tune [kernel]] [size] [runs]
+ * topencl [platform] batch [kernel] [size] [count]
+ * topencl [platform] lowp [size] [runs]
+ * topencl [platform] sweep [kernel] [runs]
+ * topencl [platform] multi [kernel] [size] [runs]
+ *
+ *    platform  number or part of the name, optionally :device, e.g. "intel:gpu"
+ *              (env CLUTL_PLATFORM / CLUTL_DEVICE when omitted, see clutl_device_list)
+ *
+ *    kernel    one of the kernels in myGEMM.cl, run with its tuned config
+ *              (default: the fastest tuned kernel of the device, or myGEMM1)
+ *    tune      search build options of all (or given) kernels, see tune_myGEMM()
+ *    batch     stream of count GEMMs (default 256x256, 64), see gemm_batch()
+ *    lowp      fp16/bf16/int8 GEMM on CPU & OpenCL, see lowp_myGEMM()
+ *    sweep     shapes x (CPU + all or given kernel) on a roofline, see sweep_myGEMM()
+ *    multi     one GEMM split over all devices & CPU sub-devices, see multi_myGEMM()
+ */
+// subcommand or kernel name, argv[1] is the platform only if it's neither
+static int is_command_arg(const char * s)
+{
+	static const char * const cmds[] = {"tune", "batch", "lowp", "sweep", "multi"};
+	for(size_t k = 0; k < sizeof(cmds)/sizeof(cmds[0]); k++)
+		if(strcmp(s, cmds[k]) == 0) return 1;
+	return strncmp(s, "myGEMM", 6) == 0;
+}
 
 int main(int argc, char * argv[])
 {
@@ -37,13 +90,35 @@ int main(int argc, char * argv[])
     //setenv("OCL_OUTPUT_BUILD_LOG","1",1);
 
 
-	/* select platform or just show all of them*/
-	if(argc > 1) {
-		i = atoi(argv[1]);
+	/* select platform: argv[1] or env CLUTL_PLATFORM, as number or name,
+	 * optionally followed by :device (see clutl_device_list, env CLUTL_DEVICE).
+	 * ask on the terminal if neither is given, take the 1st one when unattended */
+	char platform_spec[256] = "";
+	int arg = 1;
+	const char * spec = getenv("CLUTL_PLATFORM");
+	if(argc > 1 && !is_command_arg(argv[1]))
+		spec = argv[arg++];
+	g_device_spec = getenv("CLUTL_DEVICE");
+	if(spec && spec[0]){
+		snprintf(platform_spec, sizeof(platform_spec), "%s", spec);
+		char * colon = strchr(platform_spec, ':');
+		if(colon){
+			*colon = 0;
+			g_device_spec = spec + (colon - platform_spec) + 1;
+		}
+	}
+
+	if(platform_spec[0]) {
+		i = clutl_platform_find(platform_spec);
 		if(clutl_platform_select(i, &platform_id))
-			fprintf(stderr, "clutl_platform_select error\n"), exit(1);
+			fprintf(stderr, "clutl_platform_select error: no platform %s\n", platform_spec), exit(1);
+	}else if(!isatty(STDIN_FILENO)){
+		if(clutl_platform_select(1, &platform_id))
+			fprintf(stderr, "clutl_platform_select error: no platform\n"), exit(1);
 	}else{
 		cnt = clutl_platform_select(-1, &platform_id);
+		if(cnt <= 0)
+			fprintf(stderr, "clutl_platform_select error: no platform\n"), exit(1);
 		printf("=======================\n");
 		printf("Please select platform:");
 		i = fgetc(stdin) - '0';
@@ -54,158 +129,1677 @@ int main(int argc, char * argv[])
 			fprintf(stderr, "clutl_platform_select error\n"), exit(1);
 	}
 	
-	run_myGEMM(platform_id, argc > 2?argv[2]:"myGEMM1");
+	int tune = (argc > arg && strcmp(argv[arg], "tune") == 0);
+	int batch = (argc > arg && strcmp(argv[arg], "batch") == 0);
+	int lowp = (argc > arg && strcmp(argv[arg], "lowp") == 0);
+	int sweep = (argc > arg && strcmp(argv[arg], "sweep") == 0);
+	int multi = (argc > arg && strcmp(argv[arg], "multi") == 0);
+	if(tune || batch || lowp || sweep || multi) arg++;
+
+	const char * kernel_name = NULL;
+	if(argc > arg && !isdigit(argv[arg][0]))
+		kernel_name = argv[arg++];
+
+	if(sweep){
+		int runs = argc > arg ? atoi(argv[arg++]) : 3;
+		sweep_myGEMM(platform_id, kernel_name, runs > 0 ? runs : 3);
+		return 0;
+	}
+
+	int size = argc > arg ? atoi(argv[arg++]) : (batch ? 256 : SIZE);
+	int runs = argc > arg ? atoi(argv[arg++]) : (batch ? 64 : NUM_RUNS);
+	if(size <= 0) size = SIZE;
+	if(runs <= 0) runs = NUM_RUNS;
+
+	if(multi)
+		multi_myGEMM(kernel_name, size, runs);
+	else if(lowp)
+		lowp_myGEMM(platform_id, size, runs);
+	else if(batch)
+		batch_myGEMM(platform_id, kernel_name, size, runs);
+	else if(tune)
+		tune_myGEMM(platform_id, kernel_name, size, runs);
+	else
+		run_myGEMM(platform_id, kernel_name, size, runs);
 }
 
 
 
 
 
-// Repeat all kernels multiple times to get an average timing result
-#define NUM_RUNS 10
+/***************************************************************************
+ kernel table
 
-// Size of the matrices - K, M, N (squared)
-#define SIZE (4096/4)
+ every GEMM kernel in myGEMM.cl has the same (M,N,K,A,B,C) signature,
+ its compile time parameters are passed as -D options at build time:
+     TS     tile size (work-group is TS x TS)
+     WPT    work per thread
+     WIDTH  vector width
+
+ kernels that need B transposed or sizes padded to their tiles get
+ transpose/paddingAddZeroes/paddingRemoveZeroes enqueued around them,
+ which is part of their timing.
 
-// Threadblock sizes (e.g. for kernels myGEMM1 or myGEMM2)
-#define TS 32
-void run_myGEMM(cl_platform_id platform_id, const char * kernel_filename)
+ the autotuner walks the candidate lists of each kernel, the best
+ config per device is kept in myGEMM.tune (env CLUTL_TUNE_FILE)
+********************************************************/
+struct gemm_config
 {
-    cl_device_id device_id = NULL;
-    cl_program program = NULL;
+	int ts;
+	int wpt;
+	int width;
+};
 
-    cl_uint ret_num_devices;
-    cl_uint ret_num_platforms;
-    cl_int ret;
+struct gemm_shape
+{
+	int M, N, K;		// problem size
+	int Mp, Np, Kp;		// size the kernel runs on, zero padded
+};
 
-    double tbase;
+#define GEMM_TRANS_B	1		// kernel takes BT (N x K) instead of B
+#define GEMM_TSK		16		// TSK in myGEMM.cl
 
-    // Set the sizes
-    int K = SIZE;
-    int M = SIZE;
-    int N = SIZE;
+struct gemm_kernel_desc
+{
+	const char *	name;
+	gemm_config		def;		// used when nothing is tuned yet
+	int				ts[8];		// candidates, 0 terminated
+	int				wpt[8];
+	int				width[8];
+	int				flags;
+	// NDRange of config, sets padded size of s; return 0 if the config can't handle s
+	int (*ndrange)(const gemm_config & cfg, gemm_shape & s, size_t global[2], size_t local[2]);
+};
+
+static int round_up(int x, int m)
+{
+	return (x + m - 1) / m * m;
+}
+
+// one work-item per element of C
+static int ndrange_2d(const gemm_config & cfg, gemm_shape & s, size_t global[2], size_t local[2])
+{
+	if(s.M % cfg.ts || s.N % cfg.ts) return 0;
+	s.Mp = s.M;	s.Np = s.N;	s.Kp = s.K;
+	global[0] = s.M;	global[1] = s.N;
+	local[0] = cfg.ts;	local[1] = cfg.ts;
+	return 1;
+}
+
+// same but dim0 walks columns of C (myGEMM1b)
+static int ndrange_2d_t(const gemm_config & cfg, gemm_shape & s, size_t global[2], size_t local[2])
+{
+	if(!ndrange_2d(cfg, s, global, local)) return 0;
+	global[0] = s.N;	global[1] = s.M;
+	return 1;
+}
+
+// tiled kernels loop over K in whole tiles
+static int ndrange_tiled(const gemm_config & cfg, gemm_shape & s, size_t global[2], size_t local[2])
+{
+	if(s.K % cfg.ts) return 0;
+	return ndrange_2d(cfg, s, global, local);
+}
+
+// WPT columns per work-item (myGEMM3)
+static int ndrange_wpt(const gemm_config & cfg, gemm_shape & s, size_t global[2], size_t local[2])
+{
+	if(cfg.ts % cfg.wpt || !ndrange_tiled(cfg, s, global, local)) return 0;
+	global[1] /= cfg.wpt;
+	local[1] /= cfg.wpt;
+	return 1;
+}
+
+// WIDTH rows per work-item as floatX (myGEMM4)
+static int ndrange_wide(const gemm_config & cfg, gemm_shape & s, size_t global[2], size_t local[2])
+{
+	if(cfg.ts % cfg.width || !ndrange_tiled(cfg, s, global, local)) return 0;
+	global[0] /= cfg.width;
+	local[0] /= cfg.width;
+	return 1;
+}
+
+// myGEMM5: like myGEMM3 on zero padded sizes
+static int ndrange_wpt_padded(const gemm_config & cfg, gemm_shape & s, size_t global[2], size_t local[2])
+{
+	if(cfg.ts % cfg.wpt) return 0;
+	s.Mp = round_up(s.M, cfg.ts);
+	s.Np = round_up(s.N, cfg.ts);
+	s.Kp = round_up(s.K, cfg.ts);
+	global[0] = s.Mp;	global[1] = s.Np / cfg.wpt;
+	local[0] = cfg.ts;	local[1] = cfg.ts / cfg.wpt;
+	return 1;
+}
+
+// myGEMM6: WPT x WPT per work-item, K padded to TSK
+static int ndrange_2d_reg(const gemm_config & cfg, gemm_shape & s, size_t global[2], size_t local[2])
+{
+	int rts = cfg.ts / cfg.wpt;
+	if(cfg.ts % cfg.wpt || (GEMM_TSK * cfg.ts) % (rts * rts)) return 0;
+	s.Mp = round_up(s.M, cfg.ts);
+	s.Np = round_up(s.N, cfg.ts);
+	s.Kp = round_up(s.K, GEMM_TSK);
+	global[0] = s.Mp / cfg.wpt;	global[1] = s.Np / cfg.wpt;
+	local[0] = rts;				local[1] = rts;
+	return 1;
+}
+
+static const gemm_kernel_desc gemm_kernels[] = {
+	{"myGEMM1",		{16, 1, 1},	{4, 8, 16, 32, 0},	{1, 0},			{1, 0},			0,				ndrange_2d},
+	{"myGEMM1b",	{16, 1, 1},	{4, 8, 16, 32, 0},	{1, 0},			{1, 0},			0,				ndrange_2d_t},
+	{"myGEMM2",		{16, 1, 1},	{4, 8, 16, 32, 0},	{1, 0},			{1, 0},			0,				ndrange_tiled},
+	{"myGEMM3",		{32, 8, 1},	{16, 32, 64, 0},	{1, 2, 4, 8, 0},	{1, 0},			0,				ndrange_wpt},
+	{"myGEMM4",		{32, 1, 4},	{16, 32, 64, 0},	{1, 0},			{1, 2, 4, 8, 0},	0,				ndrange_wide},
+	{"myGEMM5",		{32, 8, 1},	{16, 32, 64, 0},	{1, 2, 4, 8, 0},	{1, 0},			GEMM_TRANS_B,	ndrange_wpt_padded},
+	{"myGEMM6",		{64, 8, 1},	{32, 64, 128, 0},	{2, 4, 8, 0},		{1, 0},			GEMM_TRANS_B,	ndrange_2d_reg},
+};
+
+static const gemm_kernel_desc * gemm_kernel_find(const char * name)
+{
+	for(unsigned i = 0; i < sizeof(gemm_kernels)/sizeof(gemm_kernels[0]); i++)
+		if(strcmp(gemm_kernels[i].name, name) == 0)
+			return &gemm_kernels[i];
+	return NULL;
+}
+
+static void gemm_config_options(const gemm_config & cfg, char * opt, size_t size)
+{
+	snprintf(opt, size, "-DTS=%d -DWPT=%d -DWIDTH=%d", cfg.ts, cfg.wpt, cfg.width);
+}
+
+//=====================================================================
+// tuning database, one line per device & kernel:
+//      device<TAB>kernel<TAB>TS WPT WIDTH<TAB>GFLOPS
+
+static const char * tune_file(void)
+{
+	const char * f = getenv("CLUTL_TUNE_FILE");
+	return f ? f : "./myGEMM.tune";
+}
+
+// kernel == NULL: the fastest kernel tuned on this device, name goes to kernel_out
+static int tune_load(const char * device, const char * kernel, gemm_config & cfg,
+					 double * gflops, char * kernel_out, size_t kernel_size)
+{
+	char line[1024], dev[512], name[128];
+	gemm_config c;
+	double g, best = -1;
+	FILE * fp = fopen(tune_file(), "r");
+	if(fp == NULL) return 0;
+
+	while(fgets(line, sizeof(line), fp)){
+		if(sscanf(line, "%511[^\t]\t%127[^\t]\t%d %d %d\t%lf", dev, name, &c.ts, &c.wpt, &c.width, &g) != 6)
+			continue;
+		if(strcmp(dev, device) || (kernel && strcmp(name, kernel)) || g <= best)
+			continue;
+		best = g;
+		cfg = c;
+		if(gflops) *gflops = g;
+		if(kernel_out) snprintf(kernel_out, kernel_size, "%s", name);
+	}
+	fclose(fp);
+	return best >= 0;
+}
+
+static void tune_save(const char * device, const char * kernel, const gemm_config & cfg, double gflops)
+{
+	std::vector<std::string> lines;
+	char line[1024], dev[512], name[128];
+	FILE * fp = fopen(tune_file(), "r");
+	if(fp){
+		while(fgets(line, sizeof(line), fp)){
+			if(sscanf(line, "%511[^\t]\t%127[^\t]", dev, name) == 2 &&
+			   strcmp(dev, device) == 0 && strcmp(name, kernel) == 0)
+				continue;
+			lines.push_back(line);
+		}
+		fclose(fp);
+	}
+	snprintf(line, sizeof(line), "%s\t%s\t%d %d %d\t%.1f\n", device, kernel, cfg.ts, cfg.wpt, cfg.width, gflops);
+	lines.push_back(line);
+
+	fp = fopen(tune_file(), "w");
+	if(fp == NULL){
+		fprintf(stderr, ">>> cannot write %s\n", tune_file());
+		return;
+	}
+	for(size_t i = 0; i < lines.size(); i++)
+		fputs(lines[i].c_str(), fp);
+	fclose(fp);
+}
+
+//=====================================================================
+// benchmark context: device, buffers & CPU reference result
+
+struct gemm_bench
+{
+	cl_device_id		device;
+	cl_context			context;
+	cl_command_queue	queue;
+	char				device_key[512];	// name + driver version
+	size_t				max_wg_size;
+	int					M, N, K;
+	float				*A, *B, *C, *D;		// D: CPU reference
+	cl_mem				bufA, bufB, bufC;
+	int					unified;			// CL_DEVICE_HOST_UNIFIED_MEMORY
+	int					zero_copy;			// bufA/B/C wrap A/B/C (CL_MEM_USE_HOST_PTR)
+	double				upload_sec;			// A & B to the device, by gemm_bench_data
+};
+
+struct gemm_result
+{
+	double	host_sec;		// per run, wall clock
+	double	event_sec;		// per run, event profiling of all stages
+	double	kernel_sec;		// per run, event profiling of the GEMM kernel only
+	double	gflops;			// by event_sec
+	double	download_sec;	// C back to the host
+	int		errors;			// mismatches against CPU reference
+};
+
+// context & profiling queue on device
+static void gemm_bench_open_device(gemm_bench & b, cl_device_id device)
+{
+	cl_int ret;
+	cl_bool unified = CL_FALSE;
+	char name[256] = "", driver[128] = "";
+	const char * env = getenv("CLUTL_ZERO_COPY");
+
+	memset(&b, 0, sizeof(b));
+	b.device = device;
+
+	// CPU devices & integrated GPUs share memory with the host, buffers can
+	// live right in host memory, CLUTL_ZERO_COPY=0 forces copies
+	clGetDeviceInfo(b.device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL);
+	b.unified = (unified == CL_TRUE);
+	b.zero_copy = b.unified && !(env && strcmp(env, "0") == 0);
+
+    clutl_device_caps(b.device);
+
+	clGetDeviceInfo(b.device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+	clGetDeviceInfo(b.device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+	clGetDeviceInfo(b.device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(b.max_wg_size), &b.max_wg_size, NULL);
+	snprintf(b.device_key, sizeof(b.device_key), "%s / %s", name, driver);
+	for(char * p = b.device_key; *p; p++)
+		if(*p == '\t' || *p == '\n') *p = ' ';
+
+    b.context = clCreateContext(NULL, 1, &b.device, NULL, NULL, &ret); /* Create OpenCL context */
+    b.queue = clCreateCommandQueue(b.context, b.device, CL_QUEUE_PROFILING_ENABLE, &ret); /* Create Command Queue */
+}
+
+// device of platform picked by g_device_spec
+static void gemm_bench_open(gemm_bench & b, cl_platform_id platform_id)
+{
+	cl_device_id device;
+
+	if(clutl_device_list(platform_id, g_device_spec, &device, 1) != 1){
+		fprintf(stderr, ">>> no OpenCL device \"%s\" on this platform\n", g_device_spec ? g_device_spec : "default");
+		exit(1);
+	}
+	gemm_bench_open_device(b, device);
+}
+
+// page aligned & size rounded to a cache line, what drivers want for zero copy
+static float * gemm_host_alloc(gemm_bench & b, size_t size)
+{
+	void * p = NULL;
+	if(!b.zero_copy)
+		return (float*)malloc(size);
+	if(posix_memalign(&p, 4096, (size + 63) & ~(size_t)63))
+		return NULL;
+	return (float*)p;
+}
+
+static void gemm_bench_free_data(gemm_bench & b)
+{
+	if(b.bufA) clReleaseMemObject(b.bufA);
+	if(b.bufB) clReleaseMemObject(b.bufB);
+	if(b.bufC) clReleaseMemObject(b.bufC);
+	free(b.A);
+	free(b.B);
+	free(b.C);
+	free(b.D);
+	b.bufA = b.bufB = b.bufC = NULL;
+	b.A = b.B = b.C = b.D = NULL;
+}
+
+// (re)create host & device matrices of given shape, returns seconds of the CPU reference.
+// A & B are copied from A_src/B_src if given (column-major, ld = M & K)
+static double gemm_bench_data(gemm_bench & b, int M, int N, int K,
+							  const float * A_src = NULL, const float * B_src = NULL)
+{
+	double tbase;
+
+	gemm_bench_free_data(b);
+	b.M = M;
+	b.N = N;
+	b.K = K;
 
     // Create the matrices and initialize them with random values
-    float* A = (float*)malloc(M*K*sizeof(float*));
-    float* B = (float*)malloc(K*N*sizeof(float*));
-    float* C = (float*)malloc(M*N*sizeof(float*));
-    float* D = (float*)malloc(M*N*sizeof(float*) + 1);
-    for (int i=0; i<M*K; i++) { A[i] = 3.6*i + i*i + 3.1; }
-    for (int i=0; i<K*N; i++) { B[i] = 1.2*i + 0.01*i*i + 13.9; }
-    for (int i=0; i<M*N; i++) { C[i] = 0.0; }
-
-    const char * cl_filename = "./myGEMM.cl";
-
-	printf("run_myGEMM() with %s...start \n", cl_filename);
-	printf("CPU version start ... \n");
-	tbase = gettime_sec();
+    b.A = gemm_host_alloc(b, (size_t)M*K*sizeof(float));
+    b.B = gemm_host_alloc(b, (size_t)K*N*sizeof(float));
+    b.C = gemm_host_alloc(b, (size_t)M*N*sizeof(float));
+    b.D = (float*)malloc((size_t)M*N*sizeof(float));
+    for (int i=0; i<M*K; i++) { b.A[i] = A_src ? A_src[i] : 3.6*i + i*i + 3.1; }
+    for (int i=0; i<K*N; i++) { b.B[i] = B_src ? B_src[i] : 1.2*i + 0.01*i*i + 13.9; }
+    for (int i=0; i<M*N; i++) { b.C[i] = 0.0; }
 
-	if(load_bin("myGEMM.matD", D, (M*N + 1)*sizeof(float*)) <= 0){
-		matmult(A,B,D,M,K,N);
-		D[M*N] = (float)(gettime_sec() - tbase);
-		save_bin("myGEMM.matD", D, (M*N + 1)*sizeof(float*));
+	tbase = gettime_sec();
+	matmult(b.A,b.B,b.D,M,K,N);
+	tbase = gettime_sec() - tbase;
+
+	double t = gettime_sec();
+	if(b.zero_copy){
+		// device works on the host arrays, nothing to copy
+		b.bufA = clCreateBuffer(b.context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,  (size_t)M*K*sizeof(float), b.A, NULL);
+		b.bufB = clCreateBuffer(b.context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,  (size_t)K*N*sizeof(float), b.B, NULL);
+		b.bufC = clCreateBuffer(b.context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, (size_t)M*N*sizeof(float), b.C, NULL);
+	}else{
+	    // Prepare OpenCL memory objects
+	    b.bufA = clCreateBuffer(b.context, CL_MEM_READ_ONLY,  (size_t)M*K*sizeof(float), NULL, NULL);
+	    b.bufB = clCreateBuffer(b.context, CL_MEM_READ_ONLY,  (size_t)K*N*sizeof(float), NULL, NULL);
+	    b.bufC = clCreateBuffer(b.context, CL_MEM_READ_WRITE, (size_t)M*N*sizeof(float), NULL, NULL);
+
+	    // Copy matrices to the GPU
+	    clEnqueueWriteBuffer(b.queue, b.bufA, CL_TRUE, 0, (size_t)M*K*sizeof(float), b.A, 0, NULL, NULL);
+	    clEnqueueWriteBuffer(b.queue, b.bufB, CL_TRUE, 0, (size_t)K*N*sizeof(float), b.B, 0, NULL, NULL);
 	}
+	b.upload_sec = gettime_sec() - t;
+	return tbase;
+}
 
-	printf("CPU version complete %.3f sec\n", D[M*N]);
+static void gemm_bench_init(gemm_bench & b, cl_platform_id platform_id, int size)
+{
+	gemm_bench_open(b, platform_id);
 
-    ret = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_DEFAULT, 1, &device_id, &ret_num_devices);
+	printf("CPU version (%s x %d threads) start ... \n", cpu_sgemm_kernel_name(), cpu_sgemm_get_threads());
+	double tbase = gemm_bench_data(b, size, size, size);
+	printf("CPU version complete %.3f sec, %.1lf GFLOPS\n", tbase, 2.0*size*size*size/tbase*1e-9);
+}
 
-    clutl_device_caps(device_id);
+static void gemm_bench_release(gemm_bench & b)
+{
+	gemm_bench_free_data(b);
 
-    //clCreateSubDevices(device_id, CL_DEVICE_PARTITION_BY_COUNTS, )
+    // Clean-up OpenCL
+    clReleaseCommandQueue(b.queue);
+    clReleaseContext(b.context);
+}
 
-    cl_context context = clCreateContext(NULL, 1, &device_id, NULL, NULL, &ret); /* Create OpenCL context */
-    cl_command_queue queue = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &ret); /* Create Command Queue */
+struct gemm_stage
+{
+	cl_kernel	kernel;
+	size_t		global[2];
+	size_t		local[2];		// local[0] == 0: up to the driver
+};
+
+// helper kernels all take (int P, int Q, in, int P2, int Q2, out)
+static cl_kernel gemm_helper_kernel(cl_program program, const char * name,
+									int P, int Q, cl_mem in, int P2, int Q2, cl_mem out)
+{
+	cl_int ret;
+	cl_kernel kernel = clCreateKernel(program, name, &ret);
+	clutl_CheckError(ret);
+	if(kernel == NULL) return NULL;
+
+	clSetKernelArg(kernel, 0, sizeof(int), (void*)&P);
+	clSetKernelArg(kernel, 1, sizeof(int), (void*)&Q);
+	clSetKernelArg(kernel, 2, sizeof(cl_mem), (void*)&in);
+	clSetKernelArg(kernel, 3, sizeof(int), (void*)&P2);
+	clSetKernelArg(kernel, 4, sizeof(int), (void*)&Q2);
+	clSetKernelArg(kernel, 5, sizeof(cl_mem), (void*)&out);
+	return kernel;
+}
 
-    if(clutl_build_program(context, device_id,	cl_filename, &program))
-    	fprintf(stderr,"clutl_build_program error\n"),exit(1);
-    //setenv("OCL_OUTPUT_ASM","1",0);
-    //setenv("OCL_OUTPUT_BUILD_LOG","1",0);
+// build desc with cfg, run it (1 warm up + runs) and check against CPU reference
+// return: 0 on success, otherwise the config is not usable on this device
+static int gemm_bench_run(gemm_bench & b, const gemm_kernel_desc & desc, const gemm_config & cfg,
+						  int runs, gemm_result & r)
+{
+	const char * cl_filename = "./myGEMM.cl";
+	int M = b.M, N = b.N, K = b.K;
+	gemm_shape s = {M, N, K, M, N, K};
+	gemm_stage stages[4];
+	int nstages = 0, gemm_stage_id = 0, ret_code = 0;
+	cl_mem tmpA = NULL, tmpB = NULL, tmpC = NULL;
+	cl_mem bufA = b.bufA, bufB = b.bufB, bufC = b.bufC;
+	size_t kernel_wg_size = 0;
+	char options[256];
+	cl_program program = NULL;
+	cl_int ret;
 
-    // Prepare OpenCL memory objects
-    cl_mem bufA = clCreateBuffer(context, CL_MEM_READ_ONLY,  M*K*sizeof(float), NULL, NULL);
-    cl_mem bufB = clCreateBuffer(context, CL_MEM_READ_ONLY,  K*N*sizeof(float), NULL, NULL);
-    cl_mem bufC = clCreateBuffer(context, CL_MEM_READ_WRITE, M*N*sizeof(float), NULL, NULL);
+	gemm_stage g;
+	memset(stages, 0, sizeof(stages));
+	memset(&g, 0, sizeof(g));
 
-    // Copy matrices to the GPU
-    clEnqueueWriteBuffer(queue, bufA, CL_TRUE, 0, M*K*sizeof(float), A, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, bufB, CL_TRUE, 0, K*N*sizeof(float), B, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, bufC, CL_TRUE, 0, M*N*sizeof(float), C, 0, NULL, NULL);
+	if(!desc.ndrange(cfg, s, g.global, g.local) || g.local[0] * g.local[1] > b.max_wg_size)
+		return 1;
+
+	gemm_config_options(cfg, options, sizeof(options));
+	if(clutl_build_program(b.context, b.device, cl_filename, options, &program))
+		return 2;
+
+	// pre-processing: pad A, transpose (& pad) B
+	if(s.Mp != M || s.Kp != K){
+		tmpA = clCreateBuffer(b.context, CL_MEM_READ_WRITE, (size_t)s.Mp*s.Kp*sizeof(float), NULL, NULL);
+		gemm_stage & st = stages[nstages++];
+		st.kernel = gemm_helper_kernel(program, "paddingAddZeroes", M, K, bufA, s.Mp, s.Kp, tmpA);
+		st.global[0] = s.Mp;	st.global[1] = s.Kp;
+		bufA = tmpA;
+	}
+	if(desc.flags & GEMM_TRANS_B){
+		tmpB = clCreateBuffer(b.context, CL_MEM_READ_WRITE, (size_t)s.Np*s.Kp*sizeof(float), NULL, NULL);
+		gemm_stage & st = stages[nstages++];
+		st.kernel = gemm_helper_kernel(program, "transpose", K, N, bufB, s.Kp, s.Np, tmpB);
+		st.global[0] = round_up(s.Kp, 16);	st.global[1] = round_up(s.Np, 16);
+		st.local[0] = 16;					st.local[1] = 16;	// TRANSPOSEX/Y
+		bufB = tmpB;
+	}else if(s.Kp != K || s.Np != N){
+		tmpB = clCreateBuffer(b.context, CL_MEM_READ_WRITE, (size_t)s.Kp*s.Np*sizeof(float), NULL, NULL);
+		gemm_stage & st = stages[nstages++];
+		st.kernel = gemm_helper_kernel(program, "paddingAddZeroes", K, N, bufB, s.Kp, s.Np, tmpB);
+		st.global[0] = s.Kp;	st.global[1] = s.Np;
+		bufB = tmpB;
+	}
+	if(s.Mp != M || s.Np != N){
+		tmpC = clCreateBuffer(b.context, CL_MEM_READ_WRITE, (size_t)s.Mp*s.Np*sizeof(float), NULL, NULL);
+		bufC = tmpC;
+	}
 
     // Configure the myGEMM kernel and set its arguments
-    cl_kernel kernel = clCreateKernel(program, kernel_filename, &ret);
-    clutl_CheckError(ret);
-
-    clSetKernelArg(kernel, 0, sizeof(int), (void*)&M);
-    clSetKernelArg(kernel, 1, sizeof(int), (void*)&N);
-    clSetKernelArg(kernel, 2, sizeof(int), (void*)&K);
-    clSetKernelArg(kernel, 3, sizeof(cl_mem), (void*)&bufA);
-    clSetKernelArg(kernel, 4, sizeof(cl_mem), (void*)&bufB);
-    clSetKernelArg(kernel, 5, sizeof(cl_mem), (void*)&bufC);
-
-    cl_double g_NDRangePureExecTimeNs = 0;
-    // Start the timed loop
-    printf(">>> Starting %d myGEMM runs...\n", NUM_RUNS);
-    double starttime = gettime_sec();
-    for (int r=0; r<NUM_RUNS; r++) {
+	gemm_stage_id = nstages;
+	stages[nstages] = g;
+	gemm_stage & gs = stages[nstages++];
+	gs.kernel = clCreateKernel(program, desc.name, &ret);
+	clutl_CheckError(ret);
+
+	// post-processing: cut padding off C
+	if(tmpC){
+		gemm_stage & st = stages[nstages++];
+		st.kernel = gemm_helper_kernel(program, "paddingRemoveZeroes", s.Mp, s.Np, tmpC, M, N, b.bufC);
+		st.global[0] = M;	st.global[1] = N;
+	}
 
-        // Run the myGEMM kernel
-        const size_t local[2] = { 16, 16 };
-        const size_t global[2] = { M, N };
-        cl_event event = NULL;
-        cl_int err;
-        err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, local, 0, NULL, &event);
+	for(int i = 0; i < nstages; i++)
+		if(stages[i].kernel == NULL){
+			ret_code = 3;
+			goto cleanup;
+		}
 
-        clutl_CheckError(err);
+	// local memory/registers may not allow this work-group size
+	clGetKernelWorkGroupInfo(gs.kernel, b.device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernel_wg_size), &kernel_wg_size, NULL);
+	if(kernel_wg_size && gs.local[0] * gs.local[1] > kernel_wg_size){
+		ret_code = 4;
+		goto cleanup;
+	}
 
-        // Wait for calculations to be finished
-        clWaitForEvents(1, &event);
+    clSetKernelArg(gs.kernel, 0, sizeof(int), (void*)&s.Mp);
+    clSetKernelArg(gs.kernel, 1, sizeof(int), (void*)&s.Np);
+    clSetKernelArg(gs.kernel, 2, sizeof(int), (void*)&s.Kp);
+    clSetKernelArg(gs.kernel, 3, sizeof(cl_mem), (void*)&bufA);
+    clSetKernelArg(gs.kernel, 4, sizeof(cl_mem), (void*)&bufB);
+    clSetKernelArg(gs.kernel, 5, sizeof(cl_mem), (void*)&bufC);
+
+	// clear result of previous config
+	if(b.zero_copy){
+		float * c = (float*)clEnqueueMapBuffer(b.queue, b.bufC, CL_TRUE, CL_MAP_WRITE, 0, (size_t)M*N*sizeof(float),
+											   0, NULL, NULL, &ret);
+		if(c){
+			memset(c, 0, (size_t)M*N*sizeof(float));
+			clEnqueueUnmapMemObject(b.queue, b.bufC, c, 0, NULL, NULL);
+		}
+	}else{
+		memset(b.C, 0, M*N*sizeof(float));
+		clEnqueueWriteBuffer(b.queue, b.bufC, CL_TRUE, 0, M*N*sizeof(float), b.C, 0, NULL, NULL);
+	}
 
-        cl_ulong start = 0, end = 0;
-        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
-        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+	// warm up (lazy JIT/allocation on some drivers)
+	for(int i = 0; i < nstages; i++){
+		ret = clEnqueueNDRangeKernel(b.queue, stages[i].kernel, 2, NULL, stages[i].global,
+									 stages[i].local[0] ? stages[i].local : NULL, 0, NULL, NULL);
+		if(ret != CL_SUCCESS) break;
+	}
+	clFinish(b.queue);
+	if(ret != CL_SUCCESS){
+		clutl_CheckError(ret);
+		ret_code = 5;
+		goto cleanup;
+	}
 
-        //END-START gives you hints on kind of “pure HW execution time”
-        //the resolution of the events is 1e-09 sec
-        g_NDRangePureExecTimeNs += (cl_double)(end - start);
-    }
+	{
+    cl_double g_NDRangePureExecTimeNs = 0, g_GemmExecTimeNs = 0;
+    double starttime = gettime_sec();
+    for (int r=0; r<runs; r++) {
+        cl_event events[4] = {NULL};
+        cl_int err;
+        for (int i=0; i<nstages; i++) {
+            err = clEnqueueNDRangeKernel(b.queue, stages[i].kernel, 2, NULL, stages[i].global,
+                                         stages[i].local[0] ? stages[i].local : NULL, 0, NULL, &events[i]);
+            clutl_CheckError(err);
+        }
 
-    // End the timed loop
+        // Wait for calculations to be finished
+        clWaitForEvents(nstages, events);
+
+        for (int i=0; i<nstages; i++) {
+            cl_ulong start = 0, end = 0;
+            clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+            clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+            clReleaseEvent(events[i]);
+
+            //END-START gives you hints on kind of “pure HW execution time”
+            //the resolution of the events is 1e-09 sec
+            g_NDRangePureExecTimeNs += (cl_double)(end - start);
+            if (i == gemm_stage_id) g_GemmExecTimeNs += (cl_double)(end - start);
+        }
+    }
     double endtime = gettime_sec();
-    double runtime = (endtime - starttime) / (double)NUM_RUNS;
 
     double gflop = ((double)K * (double)M * (double)N * 2) / (1000*1000*1000);
-    double gflop_add = ((double)M * (double)N) / (1000*1000*1000);
-    printf(">>> Done. Host side: took %.3lf seconds per run, %.1lf GFLOPS (%.1lf GFLOPS for add)\n", runtime, gflop/runtime, gflop_add/runtime);
-    printf(">>> Event Profiling: took %.3lf seconds per run\n", g_NDRangePureExecTimeNs*1e-9/(cl_double)NUM_RUNS);
+	r.host_sec = (endtime - starttime) / (double)runs;
+	r.event_sec = g_NDRangePureExecTimeNs*1e-9/(cl_double)runs;
+	r.kernel_sec = g_GemmExecTimeNs*1e-9/(cl_double)runs;
+	r.gflops = gflop / (r.event_sec > 0 ? r.event_sec : r.host_sec);
+	}
 
-    // Copy the output matrix C back to the CPU memory
-    clEnqueueReadBuffer(queue, bufC, CL_TRUE, 0, M*N*sizeof(float), C, 0, NULL, NULL);
+	{
+	double t = gettime_sec();
+	if(b.zero_copy){
+		// mapping hands the host its own array back, synchronized
+		float * c = (float*)clEnqueueMapBuffer(b.queue, b.bufC, CL_TRUE, CL_MAP_READ, 0, (size_t)M*N*sizeof(float),
+											   0, NULL, NULL, &ret);
+		r.download_sec = gettime_sec() - t;
+		r.errors = c ? matcmp(c, b.D, M, N) : M*N;
+		if(c) clEnqueueUnmapMemObject(b.queue, b.bufC, c, 0, NULL, NULL);
+		clFinish(b.queue);
+	}else{
+	    // Copy the output matrix C back to the CPU memory
+	    clEnqueueReadBuffer(b.queue, b.bufC, CL_TRUE, 0, M*N*sizeof(float), b.C, 0, NULL, NULL);
+		r.download_sec = gettime_sec() - t;
+	    r.errors = matcmp(b.C, b.D, M, N);
+	}
+	}
 
-    int ecnt = matcmp(C, D, M, N);
-    if(ecnt)
-    	printf(">>> ***** %d(%d%%) errors were found in GPU result ***** \n", ecnt, ecnt*100/(M*N));
+cleanup:
+	for(int i = 0; i < nstages; i++)
+		if(stages[i].kernel) clReleaseKernel(stages[i].kernel);
+	if(tmpA) clReleaseMemObject(tmpA);
+	if(tmpB) clReleaseMemObject(tmpB);
+	if(tmpC) clReleaseMemObject(tmpC);
+    clReleaseProgram(program);
+	return ret_code;
+}
 
-    // Free the OpenCL memory objects
-    clReleaseMemObject(bufA);
-    clReleaseMemObject(bufB);
-    clReleaseMemObject(bufC);
+// kernel_name or the fastest kernel tuned for the device (myGEMM1 if none),
+// cfg gets its tuned or default config
+static const gemm_kernel_desc * gemm_kernel_pick(const gemm_bench & b, const char * kernel_name, gemm_config & cfg)
+{
+	char best_name[128];
+	const gemm_kernel_desc * desc;
 
-    // Clean-up OpenCL
-    clReleaseCommandQueue(queue);
-    clReleaseContext(context);
-    clReleaseProgram(program);
-    clReleaseKernel(kernel);
+	if(kernel_name == NULL){
+		kernel_name = "myGEMM1";
+		if(tune_load(b.device_key, NULL, cfg, NULL, best_name, sizeof(best_name)))
+			kernel_name = best_name;
+	}
+
+	desc = gemm_kernel_find(kernel_name);
+	if(desc == NULL){
+		fprintf(stderr, ">>> unknown kernel %s\n", kernel_name);
+		return NULL;
+	}
+
+	cfg = desc->def;
+	if(tune_load(b.device_key, desc->name, cfg, NULL, NULL, 0))
+		printf(">>> using tuned config from %s\n", tune_file());
+	return desc;
+}
 
-    // Free the host memory objects
-    free(A);
-    free(B);
-    free(C);
+void run_myGEMM(cl_platform_id platform_id, const char * kernel_name, int size, int runs)
+{
+	gemm_bench b;
+	gemm_result r;
+	gemm_config cfg;
+	const gemm_kernel_desc * desc;
+
+	gemm_bench_init(b, platform_id, size);
+
+	desc = gemm_kernel_pick(b, kernel_name, cfg);
+	if(desc == NULL){
+		gemm_bench_release(b);
+		return;
+	}
 
+	char options[256];
+	gemm_config_options(cfg, options, sizeof(options));
+	printf("run_myGEMM() %s %s, %dx%dx%d...start \n", desc->name, options, b.M, b.N, b.K);
+    printf(">>> Starting %d myGEMM runs...\n", runs);
+
+	if(gemm_bench_run(b, *desc, cfg, runs, r)){
+		fprintf(stderr, ">>> %s %s can't run on this device with size %d\n", desc->name, options, size);
+	}else{
+		printf(">>> Done. Host side: took %.3lf seconds per run, %.1lf GFLOPS\n", r.host_sec, 2.0*b.M*b.N*b.K*1e-9/r.host_sec);
+		printf(">>> Event Profiling: took %.3lf seconds per run, %.1lf GFLOPS\n", r.event_sec, r.gflops);
+		if(r.kernel_sec < r.event_sec)
+			printf(">>> GEMM kernel alone (w/o transpose/padding): %.3lf seconds per run, %.1lf GFLOPS\n",
+					r.kernel_sec, 2.0*b.M*b.N*b.K*1e-9/r.kernel_sec);
+		if(r.errors)
+			printf(">>> ***** %d(%d%%) errors were found in GPU result ***** \n", r.errors, r.errors*100/(b.M*b.N));
+		printf(">>> %s: A & B upload %.3lf ms, C download %.3lf ms\n",
+				b.zero_copy ? "zero copy" : "copy", b.upload_sec*1e3, r.download_sec*1e3);
+
+		// show what zero copy saves, same kernel with copies into device buffers
+		if(b.zero_copy){
+			gemm_result rc;
+			b.zero_copy = 0;
+			gemm_bench_data(b, b.M, b.N, b.K);
+			if(gemm_bench_run(b, *desc, cfg, runs, rc) == 0)
+				printf(">>> copy     : A & B upload %.3lf ms, C download %.3lf ms, %.3lf seconds per run %s\n",
+						b.upload_sec*1e3, rc.download_sec*1e3, rc.host_sec,
+						rc.errors ? ANSI_COLOR_RED "WRONG RESULT" ANSI_COLOR_RESET : "");
+		}
+	}
+
+	gemm_bench_release(b);
 	printf("run_myGEMM()...over \n");
 }
 
+// try every candidate config of kernel_name (or all kernels), keep the best per kernel
+void tune_myGEMM(cl_platform_id platform_id, const char * kernel_name, int size, int runs)
+{
+	gemm_bench b;
+	const char * best_kernel = NULL;
+	double best_all = 0;
+
+	gemm_bench_init(b, platform_id, size);
+	printf("tune_myGEMM() on %s, %dx%dx%d, %d runs per config\n", b.device_key, b.M, b.N, b.K, runs);
+
+	for(unsigned i = 0; i < sizeof(gemm_kernels)/sizeof(gemm_kernels[0]); i++){
+		const gemm_kernel_desc & desc = gemm_kernels[i];
+		gemm_config best_cfg = desc.def;
+		double best = 0;
+
+		if(kernel_name && strcmp(kernel_name, desc.name))
+			continue;
+
+		for(const int * ts = desc.ts; *ts; ts++)
+		for(const int * wpt = desc.wpt; *wpt; wpt++)
+		for(const int * width = desc.width; *width; width++){
+			gemm_config cfg = {*ts, *wpt, *width};
+			gemm_result r;
+			char options[256];
+
+			gemm_config_options(cfg, options, sizeof(options));
+			if(gemm_bench_run(b, desc, cfg, runs, r)){
+				printf("  %-10s %-30s : n/a\n", desc.name, options);
+				continue;
+			}
+			printf("  %-10s %-30s : %8.1f GFLOPS %s\n", desc.name, options, r.gflops,
+					r.errors ? ANSI_COLOR_RED "WRONG RESULT" ANSI_COLOR_RESET : "");
+			if(r.errors == 0 && r.gflops > best){
+				best = r.gflops;
+				best_cfg = cfg;
+			}
+		}
+
+		if(best > 0){
+			char options[256];
+			gemm_config_options(best_cfg, options, sizeof(options));
+			printf(">>> best %s: %s %.1f GFLOPS\n", desc.name, options, best);
+			tune_save(b.device_key, desc.name, best_cfg, best);
+			if(best > best_all){
+				best_all = best;
+				best_kernel = desc.name;
+			}
+		}
+	}
+
+	if(best_kernel)
+		printf(">>> fastest on this device: %s %.1f GFLOPS, saved to %s\n", best_kernel, best_all, tune_file());
+	gemm_bench_release(b);
+}
+
+
+
+/***************************************************************************
+ batched GEMM: C[i] = A[i] * B[i] for a stream of equally sized matrices
+
+   upload queue    | up 0 | up 1 |      | up 2 |      | up 3 | ...
+   compute queue          | gemm 0 | gemm 1 | gemm 2 | gemm 3 | ...
+   download queue                  | dl 0 |   | dl 1 |   | dl 2 | ...
+
+ two slots of device buffers, batch i uses slot i%2. each command waits on
+ events of the one it depends on instead of the host, the host only waits
+ for batch i-2 to be downloaded before it reuses the slot for batch i.
+ host side staging buffers are CL_MEM_ALLOC_HOST_PTR (pinned), mapped once,
+ the feed callback writes A/B straight into them and sink reads C from them.
+********************************************************/
+typedef void (*gemm_batch_feed)(void * ctx, int i, float * A, float * B);
+typedef void (*gemm_batch_sink)(void * ctx, int i, const float * C);
+
+struct gemm_batch_stats
+{
+	double	wall_sec;		// first feed to last sink
+	double	kernel_sec;		// sum of GEMM kernel event time
+};
+
+// pipelined = 0 waits for every batch before feeding the next one (reference)
+// return: 0 on success
+static int gemm_batch(cl_context context, cl_device_id device,
+					  const gemm_kernel_desc & desc, const gemm_config & cfg,
+					  int M, int N, int K, int count,
+					  gemm_batch_feed feed, gemm_batch_sink sink, void * ctx,
+					  int pipelined, gemm_batch_stats & st)
+{
+	gemm_shape s = {M, N, K, M, N, K};
+	size_t global[2], local[2];
+	size_t szA = (size_t)M*K*sizeof(float), szB = (size_t)K*N*sizeof(float), szC = (size_t)M*N*sizeof(float);
+	char options[256];
+	cl_program program = NULL;
+	cl_int ret;
+
+	if(!desc.ndrange(cfg, s, global, local))
+		return 1;
+	if(s.Mp != M || s.Np != N || s.Kp != K || (desc.flags & GEMM_TRANS_B)){
+		fprintf(stderr, ">>> gemm_batch: %s needs padding/transpose stages, not supported in batch\n", desc.name);
+		return 1;
+	}
+
+	gemm_config_options(cfg, options, sizeof(options));
+	if(clutl_build_program(context, device, "./myGEMM.cl", options, &program))
+		return 2;
+	cl_kernel kernel[2] = {NULL, NULL};
+	for(int k = 0; k < 2; k++){
+		kernel[k] = clCreateKernel(program, desc.name, &ret);
+		clutl_CheckError(ret);
+		if(ret != CL_SUCCESS){
+			if(k) clReleaseKernel(kernel[0]);
+			clReleaseProgram(program);
+			return 2;
+		}
+	}
+
+	cl_command_queue upq = clCreateCommandQueue(context, device, 0, &ret);
+	cl_command_queue cq = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &ret);
+	cl_command_queue dlq = clCreateCommandQueue(context, device, 0, &ret);
+
+	cl_mem dA[2], dB[2], dC[2], pA[2], pB[2], pC[2];
+	float *hA[2], *hB[2], *hC[2];
+	cl_event ev_up[2] = {NULL, NULL}, ev_k[2] = {NULL, NULL}, ev_dl[2] = {NULL, NULL};
+
+	for(int k = 0; k < 2; k++){
+		dA[k] = clCreateBuffer(context, CL_MEM_READ_ONLY,  szA, NULL, NULL);
+		dB[k] = clCreateBuffer(context, CL_MEM_READ_ONLY,  szB, NULL, NULL);
+		dC[k] = clCreateBuffer(context, CL_MEM_WRITE_ONLY, szC, NULL, NULL);
+
+		pA[k] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, szA, NULL, NULL);
+		pB[k] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, szB, NULL, NULL);
+		pC[k] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, szC, NULL, NULL);
+		hA[k] = (float*)clEnqueueMapBuffer(upq, pA[k], CL_TRUE, CL_MAP_WRITE, 0, szA, 0, NULL, NULL, &ret);
+		hB[k] = (float*)clEnqueueMapBuffer(upq, pB[k], CL_TRUE, CL_MAP_WRITE, 0, szB, 0, NULL, NULL, &ret);
+		hC[k] = (float*)clEnqueueMapBuffer(dlq, pC[k], CL_TRUE, CL_MAP_READ,  0, szC, 0, NULL, NULL, &ret);
+
+		clSetKernelArg(kernel[k], 0, sizeof(int), (void*)&M);
+		clSetKernelArg(kernel[k], 1, sizeof(int), (void*)&N);
+		clSetKernelArg(kernel[k], 2, sizeof(int), (void*)&K);
+		clSetKernelArg(kernel[k], 3, sizeof(cl_mem), (void*)&dA[k]);
+		clSetKernelArg(kernel[k], 4, sizeof(cl_mem), (void*)&dB[k]);
+		clSetKernelArg(kernel[k], 5, sizeof(cl_mem), (void*)&dC[k]);
+	}
+
+	auto retire = [&](int i){
+		int k = i % 2;
+		clWaitForEvents(1, &ev_dl[k]);
+		sink(ctx, i, hC[k]);
+
+		cl_ulong start = 0, end = 0;
+		clGetEventProfilingInfo(ev_k[k], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+		clGetEventProfilingInfo(ev_k[k], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+		st.kernel_sec += (end - start) * 1e-9;
+
+		clReleaseEvent(ev_up[k]);
+		clReleaseEvent(ev_k[k]);
+		clReleaseEvent(ev_dl[k]);
+		ev_up[k] = ev_k[k] = ev_dl[k] = NULL;
+	};
+
+	st.kernel_sec = 0;
+	double t0 = gettime_sec();
+	for(int i = 0; i < count; i++){
+		int k = i % 2;
+
+		// slot k is free once batch i-2 is downloaded
+		if(ev_dl[k])
+			retire(i - 2);
+
+		feed(ctx, i, hA[k], hB[k]);
+
+		clEnqueueWriteBuffer(upq, dA[k], CL_FALSE, 0, szA, hA[k], 0, NULL, NULL);
+		clEnqueueWriteBuffer(upq, dB[k], CL_FALSE, 0, szB, hB[k], 0, NULL, &ev_up[k]);
+		ret = clEnqueueNDRangeKernel(cq, kernel[k], 2, NULL, global, local, 1, &ev_up[k], &ev_k[k]);
+		clutl_CheckError(ret);
+		clEnqueueReadBuffer(dlq, dC[k], CL_FALSE, 0, szC, hC[k], 1, &ev_k[k], &ev_dl[k]);
+
+		clFlush(upq);
+		clFlush(cq);
+		clFlush(dlq);
+
+		if(!pipelined)
+			retire(i);
+	}
+	for(int i = count - 2; i < count; i++)
+		if(i >= 0 && ev_dl[i % 2])
+			retire(i);
+	st.wall_sec = gettime_sec() - t0;
+
+	for(int k = 0; k < 2; k++){
+		clEnqueueUnmapMemObject(upq, pA[k], hA[k], 0, NULL, NULL);
+		clEnqueueUnmapMemObject(upq, pB[k], hB[k], 0, NULL, NULL);
+		clEnqueueUnmapMemObject(dlq, pC[k], hC[k], 0, NULL, NULL);
+	}
+	clFinish(upq);
+	clFinish(dlq);
+	for(int k = 0; k < 2; k++){
+		clReleaseMemObject(dA[k]);	clReleaseMemObject(dB[k]);	clReleaseMemObject(dC[k]);
+		clReleaseMemObject(pA[k]);	clReleaseMemObject(pB[k]);	clReleaseMemObject(pC[k]);
+		clReleaseKernel(kernel[k]);
+	}
+	clReleaseCommandQueue(upq);
+	clReleaseCommandQueue(cq);
+	clReleaseCommandQueue(dlq);
+	clReleaseProgram(program);
+	return 0;
+}
+
+// batch i is A * 2^(i%4) times B, so C[i] must be 2^(i%4) times the CPU reference
+struct batch_check
+{
+	gemm_bench *	b;
+	int				errors;
+};
+
+static void batch_feed(void * ctx, int i, float * A, float * B)
+{
+	gemm_bench & b = *((batch_check *)ctx)->b;
+	float scale = (float)(1 << (i % 4));
+	for(int j = 0; j < b.M*b.K; j++) A[j] = b.A[j] * scale;
+	memcpy(B, b.B, b.K*b.N*sizeof(float));
+}
+
+static void batch_sink(void * ctx, int i, const float * C)
+{
+	batch_check & chk = *(batch_check *)ctx;
+	gemm_bench & b = *chk.b;
+	float scale = (float)(1 << (i % 4));
+	for(int j = 0; j < b.M*b.N; j++){
+		float ref = b.D[j] * scale;
+		if(!(fabsf(C[j] - ref) <= 1e-4f * fmaxf(fabsf(C[j]), fabsf(ref))))
+			chk.errors++;
+	}
+}
+
+void batch_myGEMM(cl_platform_id platform_id, const char * kernel_name, int size, int count)
+{
+	gemm_bench b;
+	gemm_config cfg;
+	const gemm_kernel_desc * desc;
+
+	gemm_bench_init(b, platform_id, size);
+
+	desc = gemm_kernel_find(kernel_name ? kernel_name : "myGEMM2");
+	if(desc == NULL){
+		fprintf(stderr, ">>> unknown kernel %s\n", kernel_name);
+		gemm_bench_release(b);
+		return;
+	}
+	cfg = desc->def;
+	tune_load(b.device_key, desc->name, cfg, NULL, NULL, 0);
+
+	char options[256];
+	gemm_config_options(cfg, options, sizeof(options));
+	printf("batch_myGEMM() %s %s, %d batches of %dx%dx%d\n", desc->name, options, count, b.M, b.N, b.K);
+
+	double gflop = 2.0 * b.M * b.N * b.K * count * 1e-9;
+	const char * names[2] = {"wait each batch", "pipelined"};
+	for(int pipelined = 0; pipelined < 2; pipelined++){
+		batch_check chk = {&b, 0};
+		gemm_batch_stats st;
+		if(gemm_batch(b.context, b.device, *desc, cfg, b.M, b.N, b.K, count,
+					  batch_feed, batch_sink, &chk, pipelined, st)){
+			fprintf(stderr, ">>> %s %s can't run batched with size %d\n", desc->name, options, size);
+			break;
+		}
+		printf(">>> %-16s: %.3lf sec, %.1lf GFLOPS (kernel only %.1lf GFLOPS, %.0f%%)%s\n",
+				names[pipelined], st.wall_sec, gflop / st.wall_sec, gflop / st.kernel_sec,
+				100.0 * st.kernel_sec / st.wall_sec,
+				chk.errors ? ANSI_COLOR_RED " WRONG RESULT" ANSI_COLOR_RESET : "");
+	}
+
+	gemm_bench_release(b);
+}
+
+
+
+/***************************************************************************
+ low precision GEMM: fp16 / bf16 / int8 storage
+
+ A & B hold values in [-1, 1) (fp16 would overflow on the big values of
+ gemm_bench), they are rounded to the storage format and multiplied by
+ the CPU paths (cpu_gemm_fp16/bf16/s8) and the myGEMM2h/bf/i8 kernels.
+ int8 is quantized with one scale per matrix, its int32 result is scaled
+ back to float.
+ results are checked against cpu_sgemm on the fp32 inputs, the error of
+ rounding the inputs grows like sqrt(K), so that's the tolerance unit.
+********************************************************/
+enum { LOWP_F16, LOWP_BF16, LOWP_I8 };
+
+struct lowp_format
+{
+	const char *	name;
+	const char *	kernel;		// in myGEMM.cl
+	int				type;
+	size_t			elem;		// bytes per element
+	float			tol;		// * sqrt(K)
+};
+
+static const lowp_format lowp_formats[] = {
+	{"fp16", "myGEMM2h",  LOWP_F16,  2, 2e-3f},
+	{"bf16", "myGEMM2bf", LOWP_BF16, 2, 1e-2f},
+	{"int8", "myGEMM2i8", LOWP_I8,   1, 2e-2f},
+};
+
+// round X to the storage format, returns the scale applied (int8 only)
+static float lowp_convert(const lowp_format & f, const float * X, int n, void * out)
+{
+	float scale = 1.0f;
+	if(f.type == LOWP_I8){
+		float amax = 0;
+		for(int i = 0; i < n; i++) amax = fmaxf(amax, fabsf(X[i]));
+		scale = amax > 0 ? 127.0f / amax : 1.0f;
+	}
+	for(int i = 0; i < n; i++){
+		if(f.type == LOWP_F16)
+			((cpu_fp16 *)out)[i] = cpu_float_to_fp16(X[i]);
+		else if(f.type == LOWP_BF16)
+			((cpu_bf16 *)out)[i] = cpu_float_to_bf16(X[i]);
+		else
+			((int8_t *)out)[i] = (int8_t)lrintf(X[i] * scale);
+	}
+	return scale;
+}
+
+// C = A * B, tmp receives the int32 result of int8
+static void lowp_cpu(const lowp_format & f, int M, int N, int K,
+					 const void * A, const void * B, float * C, int32_t * tmp)
+{
+	if(f.type == LOWP_F16)
+		cpu_gemm_fp16(M, N, K, (const cpu_fp16 *)A, M, (const cpu_fp16 *)B, K, C, M);
+	else if(f.type == LOWP_BF16)
+		cpu_gemm_bf16(M, N, K, (const cpu_bf16 *)A, M, (const cpu_bf16 *)B, K, C, M);
+	else
+		cpu_gemm_s8(M, N, K, (const int8_t *)A, M, (const int8_t *)B, K, tmp, M);
+}
+
+// count elements off by more than atol, max_err: largest difference
+static int matcmp_tol(const float * A, const float * B, int M, int N, float atol, float * max_err)
+{
+	int ecnt = 0;
+	float emax = 0;
+	for (int i = 0; i < M*N; i++) {
+		float e = fabsf(A[i] - B[i]);
+		if(!(e <= atol)) ecnt++;
+		if(e > emax) emax = e;
+	}
+	if(max_err) *max_err = emax;
+	return ecnt;
+}
+
+// runs the OpenCL kernel of format f, average kernel time in kernel_sec,
+// result in C (int32 for int8)
+static int lowp_cl(gemm_bench & b, const lowp_format & f, const void * A, const void * B,
+				   void * C, int runs, double * kernel_sec)
+{
+	const int TS = 16;
+	int M = b.M, N = b.N, K = b.K;
+	size_t global[2] = {(size_t)M, (size_t)N}, local[2] = {(size_t)TS, (size_t)TS};
+	size_t kernel_wg_size = 0;
+	cl_program program = NULL;
+	cl_kernel kernel = NULL;
+	cl_mem bufA = NULL, bufB = NULL, bufC = NULL;
+	cl_int ret;
+	int ret_code = 0;
+	char options[64];
+
+	if(M % TS || N % TS || K % TS || (size_t)TS*TS > b.max_wg_size)
+		return 1;
+
+	snprintf(options, sizeof(options), "-DTS=%d", TS);
+	if(clutl_build_program(b.context, b.device, "./myGEMM.cl", options, &program))
+		return 2;
+
+	kernel = clCreateKernel(program, f.kernel, &ret);
+	if(kernel == NULL){
+		clutl_CheckError(ret);
+		ret_code = 3;
+		goto cleanup;
+	}
+	clGetKernelWorkGroupInfo(kernel, b.device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernel_wg_size), &kernel_wg_size, NULL);
+	if(kernel_wg_size && local[0] * local[1] > kernel_wg_size){
+		ret_code = 4;
+		goto cleanup;
+	}
+
+	bufA = clCreateBuffer(b.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, (size_t)M*K*f.elem, (void *)A, &ret);
+	bufB = clCreateBuffer(b.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, (size_t)K*N*f.elem, (void *)B, &ret);
+	bufC = clCreateBuffer(b.context, CL_MEM_WRITE_ONLY, (size_t)M*N*sizeof(float), NULL, &ret);
+	clSetKernelArg(kernel, 0, sizeof(int), (void*)&M);
+	clSetKernelArg(kernel, 1, sizeof(int), (void*)&N);
+	clSetKernelArg(kernel, 2, sizeof(int), (void*)&K);
+	clSetKernelArg(kernel, 3, sizeof(cl_mem), (void*)&bufA);
+	clSetKernelArg(kernel, 4, sizeof(cl_mem), (void*)&bufB);
+	clSetKernelArg(kernel, 5, sizeof(cl_mem), (void*)&bufC);
+
+	// warm up
+	ret = clEnqueueNDRangeKernel(b.queue, kernel, 2, NULL, global, local, 0, NULL, NULL);
+	clFinish(b.queue);
+	if(ret != CL_SUCCESS){
+		clutl_CheckError(ret);
+		ret_code = 5;
+		goto cleanup;
+	}
+
+	*kernel_sec = 0;
+	for(int r = 0; r < runs; r++){
+		cl_event ev = NULL;
+		cl_ulong start = 0, end = 0;
+		ret = clEnqueueNDRangeKernel(b.queue, kernel, 2, NULL, global, local, 0, NULL, &ev);
+		clutl_CheckError(ret);
+		clWaitForEvents(1, &ev);
+		clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+		clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+		clReleaseEvent(ev);
+		*kernel_sec += (end - start) * 1e-9;
+	}
+	*kernel_sec /= runs;
+
+	// int32 & float are the same size
+	clEnqueueReadBuffer(b.queue, bufC, CL_TRUE, 0, (size_t)M*N*sizeof(float), C, 0, NULL, NULL);
+
+cleanup:
+	if(kernel) clReleaseKernel(kernel);
+	if(bufA) clReleaseMemObject(bufA);
+	if(bufB) clReleaseMemObject(bufB);
+	if(bufC) clReleaseMemObject(bufC);
+	clReleaseProgram(program);
+	return ret_code;
+}
+
+static void lowp_report(const char * who, const lowp_format & f, double sec, double gflop,
+						const float * C, const float * R, int M, int N, int K)
+{
+	float max_err = 0;
+	int errors = matcmp_tol(C, R, M, N, f.tol * sqrtf((float)K), &max_err);
+	printf(">>> %-6s %s: %8.2f GFLOPS, max error %.3g (%.2g x sqrt(K)) %s\n",
+			who, f.name, gflop / sec, max_err, max_err / sqrtf((float)K),
+			errors ? ANSI_COLOR_RED "WRONG RESULT" ANSI_COLOR_RESET : "");
+}
+
+void lowp_myGEMM(cl_platform_id platform_id, int size, int runs)
+{
+	gemm_bench b;
+	gemm_bench_init(b, platform_id, size);
+
+	int M = b.M, N = b.N, K = b.K;
+	double gflop = 2.0 * M * N * K * 1e-9;
+	std::vector<float> A((size_t)M*K), B((size_t)K*N), R((size_t)M*N), C((size_t)M*N);
+	std::vector<int32_t> Ci((size_t)M*N);
+	std::vector<uint8_t> Al((size_t)M*K*2), Bl((size_t)K*N*2);
+
+	uint32_t seed = 1;
+	for(size_t i = 0; i < A.size(); i++) A[i] = ((seed = seed*1664525 + 1013904223) >> 8) * (2.0f / (1 << 24)) - 1.0f;
+	for(size_t i = 0; i < B.size(); i++) B[i] = ((seed = seed*1664525 + 1013904223) >> 8) * (2.0f / (1 << 24)) - 1.0f;
+
+	double t = gettime_sec();
+	cpu_sgemm(M, N, K, &A[0], M, &B[0], K, &R[0], M);
+	t = gettime_sec() - t;
+	printf("lowp_myGEMM() %dx%dx%d, fp32 reference on CPU %.2f GFLOPS, s8 kernel %s\n",
+			M, N, K, gflop / t, cpu_gemm_s8_kernel_name());
+
+	for(size_t i = 0; i < sizeof(lowp_formats)/sizeof(lowp_formats[0]); i++){
+		const lowp_format & f = lowp_formats[i];
+		float sa = lowp_convert(f, &A[0], M*K, &Al[0]);
+		float sb = lowp_convert(f, &B[0], K*N, &Bl[0]);
+		float dq = 1.0f / (sa * sb);
+
+		// CPU, best of runs
+		double best = 1e30;
+		for(int r = 0; r < runs; r++){
+			t = gettime_sec();
+			lowp_cpu(f, M, N, K, &Al[0], &Bl[0], &C[0], &Ci[0]);
+			t = gettime_sec() - t;
+			if(t < best) best = t;
+		}
+		if(f.type == LOWP_I8)
+			for(size_t j = 0; j < C.size(); j++) C[j] = Ci[j] * dq;
+		lowp_report("CPU", f, best, gflop, &C[0], &R[0], M, N, K);
+
+		// OpenCL
+		double sec = 0;
+		int ret = lowp_cl(b, f, &Al[0], &Bl[0], f.type == LOWP_I8 ? (void *)&Ci[0] : (void *)&C[0], runs, &sec);
+		if(ret){
+			fprintf(stderr, ">>> %s failed (%d) with size %d\n", f.kernel, ret, size);
+			continue;
+		}
+		if(f.type == LOWP_I8)
+			for(size_t j = 0; j < C.size(); j++) C[j] = Ci[j] * dq;
+		lowp_report("OpenCL", f, sec, gflop, &C[0], &R[0], M, N, K);
+	}
+
+	gemm_bench_release(b);
+}
+
+/***************************************************************************
+ benchmark sweep & roofline
+
+ every shape of sweep_shapes runs on cpu_sgemm and on each OpenCL kernel
+ (its tuned config), then it's placed on the roofline of its device:
+     traffic     4 * (MK + KN + MN) bytes, each matrix moved once
+     intensity   2MNK / traffic, flops per byte
+     roof        min(peak GFLOPS, intensity * bandwidth)
+ peaks are measured, not taken from spec sheets:
+     CPU     cpu_sgemm_peak_gflops() & a multi-threaded stream triad
+     OpenCL  peakFMA & streamTriad in myGEMM.cl
+ so "% roof" tells how far a kernel is from what this machine can do for
+ that shape, low % with low intensity means memory bound.
+
+ results go to stdout and to env CLUTL_SWEEP_OUT (default gemm_sweep.csv,
+ a .json name gives JSON)
+********************************************************/
+struct roofline
+{
+	double	gflops;		// FMA peak
+	double	gbps;		// stream triad bandwidth
+};
+
+static roofline host_roofline(void)
+{
+	roofline r;
+	const size_t n = 16 << 20;		// 3 x 64MB, well beyond the LLC
+	int nthreads = cpu_sgemm_get_threads();
+	std::vector<float> a(n), b(n, 1.0f), c(n, 2.0f);
+	double best = 1e30;
+
+	r.gflops = cpu_sgemm_peak_gflops();
+
+	for(int rep = 0; rep < 5; rep++){
+		double t = gettime_sec();
+		std::vector<std::thread> th;
+		for(int i = 0; i < nthreads; i++)
+			th.push_back(std::thread([&, i]{
+				size_t s = n * i / nthreads, e = n * (i + 1) / nthreads;
+				for(size_t k = s; k < e; k++)
+					a[k] = b[k] + 3.0f * c[k];
+			}));
+		for(auto & w : th) w.join();
+		t = gettime_sec() - t;
+		if(t < best) best = t;
+	}
+	r.gbps = 3.0 * n * sizeof(float) / best * 1e-9;
+	return r;
+}
+
+// return 0 on success
+static int device_roofline(gemm_bench & b, roofline & r)
+{
+	const int iters = 1024;
+	const size_t n = 8 << 20;		// floats per triad buffer
+	size_t fma_global = 1 << 18, triad_global = n / 4;
+	cl_program program = NULL;
+	cl_kernel kfma = NULL, ktriad = NULL;
+	cl_mem out = NULL, va = NULL, vb = NULL, vc = NULL;
+	cl_int ret;
+	float s = 0.999f;
+	double best_fma = 1e30, best_triad = 1e30;
+	int ret_code = 0;
+
+	if(clutl_build_program(b.context, b.device, "./myGEMM.cl", "", &program))
+		return 1;
+	kfma = clCreateKernel(program, "peakFMA", &ret);
+	ktriad = clCreateKernel(program, "streamTriad", &ret);
+	out = clCreateBuffer(b.context, CL_MEM_WRITE_ONLY, fma_global*sizeof(float), NULL, NULL);
+	va = clCreateBuffer(b.context, CL_MEM_READ_WRITE, n*sizeof(float), NULL, NULL);
+	vb = clCreateBuffer(b.context, CL_MEM_READ_WRITE, n*sizeof(float), NULL, NULL);
+	vc = clCreateBuffer(b.context, CL_MEM_READ_WRITE, n*sizeof(float), NULL, NULL);
+	if(!kfma || !ktriad || !out || !va || !vb || !vc){
+		ret_code = 2;
+		goto cleanup;
+	}
+
+	clSetKernelArg(kfma, 0, sizeof(int), (void*)&iters);
+	clSetKernelArg(kfma, 1, sizeof(float), (void*)&s);
+	clSetKernelArg(kfma, 2, sizeof(cl_mem), (void*)&out);
+	clSetKernelArg(ktriad, 0, sizeof(cl_mem), (void*)&vb);
+	clSetKernelArg(ktriad, 1, sizeof(cl_mem), (void*)&vc);
+	clSetKernelArg(ktriad, 2, sizeof(cl_mem), (void*)&va);
+	clSetKernelArg(ktriad, 3, sizeof(float), (void*)&s);
+
+	// 1st round is warm up
+	for(int rep = 0; rep < 6; rep++){
+		cl_event ev[2] = {NULL, NULL};
+		cl_ulong start, end;
+		ret = clEnqueueNDRangeKernel(b.queue, kfma, 1, NULL, &fma_global, NULL, 0, NULL, &ev[0]);
+		if(ret == CL_SUCCESS)
+			ret = clEnqueueNDRangeKernel(b.queue, ktriad, 1, NULL, &triad_global, NULL, 0, NULL, &ev[1]);
+		clFinish(b.queue);
+		if(ret != CL_SUCCESS){
+			clutl_CheckError(ret);
+			for(int i = 0; i < 2; i++) if(ev[i]) clReleaseEvent(ev[i]);
+			ret_code = 3;
+			goto cleanup;
+		}
+		for(int i = 0; i < 2; i++){
+			clGetEventProfilingInfo(ev[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+			clGetEventProfilingInfo(ev[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+			clReleaseEvent(ev[i]);
+			double t = (end - start) * 1e-9;
+			if(rep == 0 || t <= 0) continue;
+			if(i == 0 && t < best_fma) best_fma = t;
+			if(i == 1 && t < best_triad) best_triad = t;
+		}
+	}
+	r.gflops = 64.0 * iters * fma_global / best_fma * 1e-9;
+	r.gbps = 3.0 * n * sizeof(float) / best_triad * 1e-9;
+
+cleanup:
+	if(kfma) clReleaseKernel(kfma);
+	if(ktriad) clReleaseKernel(ktriad);
+	if(out) clReleaseMemObject(out);
+	if(va) clReleaseMemObject(va);
+	if(vb) clReleaseMemObject(vb);
+	if(vc) clReleaseMemObject(vc);
+	clReleaseProgram(program);
+	return ret_code;
+}
+
+struct sweep_shape
+{
+	const char *	kind;
+	int				M, N, K;
+	int				count;		// GEMMs back to back per sample
+};
+
+static const sweep_shape sweep_shapes[] = {
+	{"square",		256,	256,	256,	16},
+	{"square",		512,	512,	512,	4},
+	{"square",		1024,	1024,	1024,	1},
+	{"square",		2048,	2048,	2048,	1},
+	{"tall-skinny",	4096,	16,		4096,	1},
+	{"tall-skinny",	4096,	64,		4096,	1},
+	{"short-wide",	16,		4096,	4096,	1},
+	{"small-K",		4096,	4096,	16,		1},
+	{"small-batch",	32,		32,		32,		256},
+	{"small-batch",	64,		64,		64,		128},
+	{"small-batch",	128,	128,	128,	32},
+};
+
+struct sweep_record
+{
+	std::string		backend;	// CPU / OpenCL
+	std::string		config;		// micro-kernel or kernel + build options
+	const sweep_shape *	shape;
+	double			sec;		// per GEMM, event profiling for OpenCL
+	double			host_sec;	// per GEMM, wall clock incl. launch & sync
+	double			gflops;
+	double			gbps;		// by the traffic model above
+	double			intensity;
+	double			roof;
+	int				errors;		// CPU: against a naive loop on sampled columns
+};
+
+// b.D comes from cpu_sgemm() too, so the CPU row is checked against a plain
+// double loop instead, on up to 16 evenly spaced columns (all rows)
+static int sweep_check_cpu(const float * A, const float * B, const float * C, int M, int N, int K)
+{
+	const float rtol = 1e-4f;
+	int step = N > 16 ? N / 16 : 1;
+	int ecnt = 0;
+	for(int n = 0; n < N; n += step){
+		for(int m = 0; m < M; m++){
+			double acc = 0, mag = 0;
+			for(int k = 0; k < K; k++){
+				double p = (double)A[m + (size_t)k*M] * B[k + (size_t)n*K];
+				acc += p;
+				mag += fabs(p);
+			}
+			// relative to sum |a*b|, the usual float GEMM error bound
+			if(!(fabs(acc - C[m + (size_t)n*M]) <= rtol * mag))
+				ecnt ++;
+		}
+	}
+	return ecnt;
+}
+
+static void sweep_fill(sweep_record & r, const sweep_shape & s, const roofline & roof)
+{
+	double flop = 2.0 * s.M * s.N * s.K;
+	double bytes = 4.0 * ((double)s.M*s.K + (double)s.K*s.N + (double)s.M*s.N);
+	r.shape = &s;
+	r.gflops = flop / r.sec * 1e-9;
+	r.gbps = bytes / r.sec * 1e-9;
+	r.intensity = flop / bytes;
+	r.roof = fmin(roof.gflops, r.intensity * roof.gbps);
+
+	printf("  %-6s %-34s %-11s %5d %5d %5d %4d | %8.1f %7.1f %6.1f %8.1f %5.1f%% %s\n",
+			r.backend.c_str(), r.config.c_str(), s.kind, s.M, s.N, s.K, s.count,
+			r.gflops, r.gbps, r.intensity, r.roof, 100.0 * r.gflops / r.roof,
+			r.errors ? ANSI_COLOR_RED "WRONG RESULT" ANSI_COLOR_RESET : "");
+}
+
+static void json_string(FILE * fp, const char * str)
+{
+	fputc('"', fp);
+	for(; *str; str++){
+		if(*str == '"' || *str == '\\') fprintf(fp, "\\%c", *str);
+		else if((unsigned char)*str < 0x20) fprintf(fp, "\\u%04x", *str);
+		else fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+static void sweep_write(const char * path, const std::vector<sweep_record> & recs,
+						const char * device, const roofline & cpu, const roofline & dev)
+{
+	size_t len = strlen(path);
+	int json = len > 5 && strcmp(path + len - 5, ".json") == 0;
+	FILE * fp = fopen(path, "w");
+	if(fp == NULL){
+		fprintf(stderr, ">>> cannot write %s\n", path);
+		return;
+	}
+
+	if(json){
+		fprintf(fp, "{\n  \"device\": ");
+		json_string(fp, device);
+		fprintf(fp, ",\n  \"roofline\": {\n"
+				"    \"CPU\": {\"gflops\": %.2f, \"gbps\": %.2f},\n"
+				"    \"OpenCL\": {\"gflops\": %.2f, \"gbps\": %.2f}\n  },\n  \"results\": [\n",
+				cpu.gflops, cpu.gbps, dev.gflops, dev.gbps);
+		for(size_t i = 0; i < recs.size(); i++){
+			const sweep_record & r = recs[i];
+			fprintf(fp, "    {\"backend\": \"%s\", \"config\": ", r.backend.c_str());
+			json_string(fp, r.config.c_str());
+			fprintf(fp, ", \"kind\": \"%s\", \"M\": %d, \"N\": %d, \"K\": %d, \"count\": %d, "
+					"\"sec\": %.9f, \"host_sec\": %.9f, \"gflops\": %.2f, \"gbps\": %.2f, "
+					"\"intensity\": %.2f, \"roof_gflops\": %.2f, \"roof_pct\": %.1f, \"errors\": %d}%s\n",
+					r.shape->kind, r.shape->M, r.shape->N, r.shape->K, r.shape->count,
+					r.sec, r.host_sec, r.gflops, r.gbps, r.intensity, r.roof, 100.0 * r.gflops / r.roof,
+					r.errors, i + 1 < recs.size() ? "," : "");
+		}
+		fprintf(fp, "  ]\n}\n");
+	}else{
+		fprintf(fp, "backend,config,kind,M,N,K,count,sec,host_sec,gflops,gbps,intensity,roof_gflops,roof_pct,errors\n");
+		for(size_t i = 0; i < recs.size(); i++){
+			const sweep_record & r = recs[i];
+			fprintf(fp, "%s,\"%s\",%s,%d,%d,%d,%d,%.9f,%.9f,%.2f,%.2f,%.2f,%.2f,%.1f,%d\n",
+					r.backend.c_str(), r.config.c_str(), r.shape->kind,
+					r.shape->M, r.shape->N, r.shape->K, r.shape->count,
+					r.sec, r.host_sec, r.gflops, r.gbps, r.intensity, r.roof, 100.0 * r.gflops / r.roof,
+					r.errors);
+		}
+	}
+	fclose(fp);
+	printf(">>> %d results written to %s\n", (int)recs.size(), path);
+}
+
+void sweep_myGEMM(cl_platform_id platform_id, const char * kernel_name, int runs)
+{
+	gemm_bench b;
+	roofline cpu, dev;
+	std::vector<sweep_record> recs;
+	const char * out = getenv("CLUTL_SWEEP_OUT");
+	if(out == NULL || *out == 0) out = "gemm_sweep.csv";
+
+	gemm_bench_open(b, platform_id);
+
+	cpu = host_roofline();
+	printf("sweep_myGEMM() CPU %s x %d threads: peak %.1f GFLOPS, triad %.1f GB/s\n",
+			cpu_sgemm_kernel_name(), cpu_sgemm_get_threads(), cpu.gflops, cpu.gbps);
+	if(device_roofline(b, dev)){
+		fprintf(stderr, ">>> cannot measure the roofline of %s\n", b.device_key);
+		dev.gflops = dev.gbps = 0;
+	}
+	printf("sweep_myGEMM() %s: peak %.1f GFLOPS, triad %.1f GB/s\n", b.device_key, dev.gflops, dev.gbps);
+	printf("  %-6s %-34s %-11s %5s %5s %5s %4s | %8s %7s %6s %8s %6s\n",
+			"", "config", "shape", "M", "N", "K", "cnt", "GFLOPS", "GB/s", "flop/B", "roof", "%roof");
+
+	for(size_t si = 0; si < sizeof(sweep_shapes)/sizeof(sweep_shapes[0]); si++){
+		const sweep_shape & s = sweep_shapes[si];
+		gemm_bench_data(b, s.M, s.N, s.K);
+
+		// CPU, best sample of count GEMMs, into its own buffer: with
+		// zero-copy b.C is the storage of bufC
+		sweep_record r;
+		std::vector<float> C((size_t)s.M * s.N);
+		r.backend = "CPU";
+		r.config = cpu_sgemm_kernel_name();
+		r.sec = 1e30;
+		for(int i = 0; i < runs; i++){
+			double t = gettime_sec();
+			for(int c = 0; c < s.count; c++)
+				matmult(b.A, b.B, C.data(), s.M, s.K, s.N);
+			t = (gettime_sec() - t) / s.count;
+			if(t < r.sec) r.sec = t;
+		}
+		r.host_sec = r.sec;
+		r.errors = sweep_check_cpu(b.A, b.B, C.data(), s.M, s.N, s.K);
+		sweep_fill(r, s, cpu);
+		recs.push_back(r);
+
+		if(dev.gflops <= 0)
+			continue;
+
+		for(size_t ki = 0; ki < sizeof(gemm_kernels)/sizeof(gemm_kernels[0]); ki++){
+			const gemm_kernel_desc & desc = gemm_kernels[ki];
+			gemm_config cfg = desc.def;
+			gemm_result gr;
+			char options[256];
+
+			if(kernel_name && strcmp(kernel_name, desc.name))
+				continue;
+			tune_load(b.device_key, desc.name, cfg, NULL, NULL, 0);
+			gemm_config_options(cfg, options, sizeof(options));
+			if(gemm_bench_run(b, desc, cfg, runs * s.count, gr))
+				continue;		// shape doesn't fit the kernel
+
+			r.backend = "OpenCL";
+			r.config = std::string(desc.name) + " " + options;
+			r.sec = gr.event_sec;
+			r.host_sec = gr.host_sec;
+			r.errors = gr.errors;
+			sweep_fill(r, s, dev);
+			recs.push_back(r);
+		}
+	}
+
+	sweep_write(out, recs, b.device_key, cpu, dev);
+	gemm_bench_release(b);
+}
+
+/***************************************************************************
+ one GEMM split over all devices
 
+ columns of B & C are contiguous (column-major), so each device gets all
+ of A plus a band of N and computes its own band of C, no reduction needed.
+
+ devices are those of every platform that match CLUTL_DEVICE (all if not
+ set), CPU devices are split into sub-devices, per NUMA node/cache domain
+ by default or into env CLUTL_CPU_SUBDEVICES equal parts.
+
+ every device first runs the same calibration band alone, the bands are
+ then sized in proportion to the measured GFLOPS (rounded to MULTI_GRANULE
+ columns so all tiled kernels fit), and all devices run concurrently.
+********************************************************/
+#define MULTI_GRANULE	128
+
+struct multi_part
+{
+	gemm_bench					b;
+	const gemm_kernel_desc *	desc;
+	gemm_config					cfg;
+	int							n0, n;		// band of columns
+	double						gflops;		// calibration
+	gemm_result					r;
+	int							ret;
+};
+
+// CPU devices split into sub-devices, created ones are added to subs for release
+static void multi_devices(std::vector<cl_device_id> & devs, std::vector<cl_device_id> & subs)
+{
+	cl_platform_id platforms[32];
+	cl_uint np = 0;
+	const char * env = getenv("CLUTL_CPU_SUBDEVICES");
+	int nsub = env ? atoi(env) : 0;
+
+	clGetPlatformIDs(sizeof(platforms)/sizeof(platforms[0]), platforms, &np);
+	for(cl_uint p = 0; p < np && p < sizeof(platforms)/sizeof(platforms[0]); p++){
+		cl_device_id list[32];
+		int n = clutl_device_list(platforms[p], g_device_spec ? g_device_spec : "all", list, sizeof(list)/sizeof(list[0]));
+
+		for(int i = 0; i < n; i++){
+			cl_device_type type = 0;
+			cl_uint cus = 0, got = 0;
+			cl_device_id part[32];
+
+			clGetDeviceInfo(list[i], CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+			clGetDeviceInfo(list[i], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cus), &cus, NULL);
+			if(type & CL_DEVICE_TYPE_CPU){
+				cl_device_partition_property equally[] = {CL_DEVICE_PARTITION_EQUALLY, 0, 0};
+				cl_device_partition_property domain[] = {CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN,
+														 CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE, 0};
+				cl_int ret;
+				if(nsub > 1 && (cl_uint)nsub <= cus){
+					equally[1] = cus / nsub;
+					ret = clCreateSubDevices(list[i], equally, sizeof(part)/sizeof(part[0]), part, &got);
+				}else{
+					ret = clCreateSubDevices(list[i], domain, sizeof(part)/sizeof(part[0]), part, &got);
+				}
+				if(ret == CL_SUCCESS && got > 1){
+					if(got > sizeof(part)/sizeof(part[0])) got = sizeof(part)/sizeof(part[0]);
+					for(cl_uint k = 0; k < got; k++){
+						devs.push_back(part[k]);
+						subs.push_back(part[k]);
+					}
+					continue;
+				}
+				for(cl_uint k = 0; ret == CL_SUCCESS && k < got && k < sizeof(part)/sizeof(part[0]); k++)
+					clReleaseDevice(part[k]);
+			}
+			devs.push_back(list[i]);
+		}
+	}
+}
+
+// band of columns [n0, n0 + n) of the whole problem into p.b
+static void multi_band(multi_part & p, const float * A, const float * B, int M, int K, int n0, int n)
+{
+	p.n0 = n0;
+	p.n = n;
+	gemm_bench_data(p.b, M, n, K, A, B + (size_t)n0 * K);
+}
+
+void multi_myGEMM(const char * kernel_name, int size, int runs)
+{
+	std::vector<cl_device_id> devs, subs;
+	int M = size, N = size, K = size;
+
+	multi_devices(devs, subs);
+	if(devs.empty()){
+		fprintf(stderr, ">>> no OpenCL device\n");
+		return;
+	}
+
+	std::vector<float> A((size_t)M*K), B((size_t)K*N);
+	for (int i=0; i<M*K; i++) { A[i] = 3.6*i + i*i + 3.1; }
+	for (int i=0; i<K*N; i++) { B[i] = 1.2*i + 0.01*i*i + 13.9; }
+
+	std::vector<multi_part> parts(devs.size());
+	int cal = round_up(N / (int)devs.size(), MULTI_GRANULE);
+	if(cal > N) cal = N;
+	double total = 0, best_single = 0;
+
+	printf("multi_myGEMM() %dx%dx%d over %d devices, calibrating on %d columns\n", M, N, K, (int)devs.size(), cal);
+	for(size_t i = 0; i < parts.size(); i++){
+		multi_part & p = parts[i];
+		gemm_bench_open_device(p.b, devs[i]);
+		p.gflops = 0;
+		p.desc = gemm_kernel_pick(p.b, kernel_name, p.cfg);
+		if(p.desc == NULL)
+			continue;
+		multi_band(p, &A[0], &B[0], M, K, 0, cal);
+		if(gemm_bench_run(p.b, *p.desc, p.cfg, runs, p.r) || p.r.errors){
+			fprintf(stderr, ">>> %s can't run %s, not used\n", p.b.device_key, p.desc->name);
+			continue;
+		}
+		p.gflops = 2.0 * M * cal * K * 1e-9 / p.r.host_sec;
+		total += p.gflops;
+		if(p.gflops > best_single) best_single = p.gflops;
+		printf("  %-50s %-8s %8.1f GFLOPS\n", p.b.device_key, p.desc->name, p.gflops);
+	}
+	if(total <= 0){
+		fprintf(stderr, ">>> no usable device\n");
+	}else{
+		// bands by throughput, leftover to the fastest one
+		int n0 = 0, fastest = 0;
+		for(size_t i = 0; i < parts.size(); i++){
+			multi_part & p = parts[i];
+			p.n = (int)(N * p.gflops / total) / MULTI_GRANULE * MULTI_GRANULE;
+			if(p.gflops > parts[fastest].gflops) fastest = i;
+			n0 += p.n;
+		}
+		parts[fastest].n += N - n0;
+		n0 = 0;
+		for(size_t i = 0; i < parts.size(); i++){
+			multi_part & p = parts[i];
+			int n = p.n;
+			p.n = 0;
+			if(n > 0)
+				multi_band(p, &A[0], &B[0], M, K, n0, n);
+			n0 += n;
+		}
+
+		// all at once
+		std::vector<std::thread> th;
+		for(size_t i = 0; i < parts.size(); i++){
+			multi_part & p = parts[i];
+			if(p.n > 0)
+				th.push_back(std::thread([&p, runs]{ p.ret = gemm_bench_run(p.b, *p.desc, p.cfg, runs, p.r); }));
+		}
+		for(auto & t : th) t.join();
+
+		double slowest = 0;
+		int errors = 0, failed = 0;
+		for(size_t i = 0; i < parts.size(); i++){
+			multi_part & p = parts[i];
+			if(p.n <= 0) continue;
+			if(p.ret){
+				failed++;
+				printf("  %-50s columns %5d..%5d : failed (%d)\n", p.b.device_key, p.n0, p.n0 + p.n, p.ret);
+				continue;
+			}
+			printf("  %-50s columns %5d..%5d : %.4f sec per run %s\n", p.b.device_key, p.n0, p.n0 + p.n,
+					p.r.host_sec, p.r.errors ? ANSI_COLOR_RED "WRONG RESULT" ANSI_COLOR_RESET : "");
+			errors += p.r.errors;
+			if(p.r.host_sec > slowest) slowest = p.r.host_sec;
+		}
+		if(!failed && slowest > 0)
+			printf(">>> split: %.1f GFLOPS, best single device %.1f GFLOPS, %d errors\n",
+					2.0 * M * N * K * 1e-9 / slowest, best_single, errors);
+	}
+
+	for(size_t i = 0; i < parts.size(); i++)
+		gemm_bench_release(parts[i].b);
+	for(size_t i = 0; i < subs.size(); i++)
+		clReleaseDevice(subs[i]);
+}
 
 /* first dimension is continuously allocated in memory
  * OR we say its stored column-by-column
@@ -215,23 +1809,19 @@ void run_myGEMM(cl_platform_id platform_id, const char * kernel_filename)
  * */
 void matmult(float *A, float *B, float * C, int M, int K, int N)
 {
-	for (int m=0; m<M; m++) {
-		for (int n=0; n<N; n++) {
-			float acc = 0.0f;
-			for (int k=0; k<K; k++) {
-				acc += A[k*M + m] * B[n*K + k];
-			}
-			C[n*M + m] = acc;
-		}
-	}
+	cpu_sgemm(M, N, K, A, M, B, K, C, M);
 }
 
+/* blocked/FMA CPU GEMM and the GPU kernels sum in different order,
+ * so compare with a relative tolerance instead of bit-exact */
 int matcmp(float *A, float *B, int M, int N)
 {
+	const float rtol = 1e-4f;
 	int ecnt = 0;
 	for (int m=0; m<M; m++) {
 		for (int n=0; n<N; n++) {
-			if(A[m + n*M] != B[m + n*M])
+			float a = A[m + n*M], b = B[m + n*M];
+			if(!(fabsf(a - b) <= rtol * fmaxf(fabsf(a), fabsf(b))))
 				ecnt ++;
 		}
 	}
@@ -251,40 +1841,28 @@ double gettime_sec(void)
 
 
 
-char * load_src(const char *fileName)
+// whole file, 0 terminated, buffer sized from the file
+char * load_src(const char *fileName, size_t * size)
 {
-#define MAX_SOURCE_SIZE (0x100000)
 	char * source_str = NULL;
-	FILE *fp = fopen(fileName, "r");
-	size_t source_size = 0;
+	FILE *fp = fopen(fileName, "rb");
+	long source_size = 0;
     if (!fp) {
-		fprintf(stderr, "Failed to load kernel.\n");
+		fprintf(stderr, "Failed to load %s.\n", fileName);
 		return NULL;
     }
-    source_str = (char*)malloc(MAX_SOURCE_SIZE);
-    source_size = fread(source_str, 1, MAX_SOURCE_SIZE, fp);
+    fseek(fp, 0, SEEK_END);
+    source_size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (source_size < 0) source_size = 0;
+
+    source_str = (char*)malloc(source_size + 1);
+    source_size = fread(source_str, 1, source_size, fp);
     source_str[source_size] = 0;
     fclose(fp);
+    if (size) *size = source_size;
     return source_str;
 }
-int load_bin(const char *filename, void * data, int size)
-{
-	int ret = 0;
-	FILE *fp = fopen(filename, "rb");
-	if(fp == NULL) return 0;
-	ret = fread(data, 1, size, fp);
-	fclose(fp);
-	return ret;
-}
-int save_bin(const char *filename, void * data, int size)
-{
-	int ret = 0;
-	FILE *fp = fopen(filename, "wb");
-	if(fp == NULL) return 0;
-	ret = fwrite(data, 1, size, fp);
-	fclose(fp);
-	return ret;
-}
 void show_runtime_map(void)
 {
 	char map_line[1024];
@@ -443,22 +2021,144 @@ void clutl_device_caps(cl_device_id device)
 }
 
 		
+/*
+ * program binary cache
+ *
+ * binaries from clGetProgramInfo(CL_PROGRAM_BINARIES) are kept under
+ * $CLUTL_CACHE_DIR (default ./.clcache, empty string disables the cache),
+ * file name is a FNV-1a hash of device name, device/driver/platform version,
+ * build options and source text, so any of them changing is a cache miss.
+ * a binary the driver refuses is simply rebuilt from source.
+ */
+static uint64_t fnv1a(uint64_t h, const void * data, size_t size)
+{
+	const unsigned char * p = (const unsigned char *)data;
+	for(size_t i = 0; i < size; i++){
+		h ^= p[i];
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+static uint64_t fnv1a_str(uint64_t h, const char * str)
+{
+	return fnv1a(h, str, strlen(str) + 1);	// '\0' separates fields
+}
+
+static int clutl_cache_path(cl_device_id device, const char * options,
+							const char * src, size_t src_size,
+							char * path, size_t path_size)
+{
+	const char * dir = getenv("CLUTL_CACHE_DIR");
+	cl_platform_id platform = NULL;
+	char info[1024];
+	uint64_t h = 0xcbf29ce484222325ull;
+
+	if(dir == NULL) dir = "./.clcache";
+	if(dir[0] == 0) return 0;
+
+	const cl_device_info dev_keys[] = {CL_DEVICE_NAME, CL_DEVICE_VERSION, CL_DRIVER_VERSION};
+	for(unsigned i = 0; i < sizeof(dev_keys)/sizeof(dev_keys[0]); i++){
+		info[0] = 0;
+		clGetDeviceInfo(device, dev_keys[i], sizeof(info), info, NULL);
+		h = fnv1a_str(h, info);
+	}
+	info[0] = 0;
+	clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL);
+	clGetPlatformInfo(platform, CL_PLATFORM_VERSION, sizeof(info), info, NULL);
+	h = fnv1a_str(h, info);
+
+	h = fnv1a_str(h, options ? options : "");
+	h = fnv1a(h, src, src_size);
+
+	// a cut path would name some other file, go without the cache instead
+	if(snprintf(path, path_size, "%s/%016llx.bin", dir, (unsigned long long)h) >= (int)path_size)
+		return 0;
+	mkdir(dir, 0755);
+	return 1;
+}
+
+static cl_program clutl_cache_load(cl_context context, cl_device_id device, const char * path, const char * options)
+{
+	size_t size = 0;
+	unsigned char * bin = (unsigned char *)load_src(path, &size);
+	cl_int status = CL_SUCCESS, err = CL_SUCCESS;
+	cl_program program;
+
+	if(bin == NULL) return NULL;
+
+	program = clCreateProgramWithBinary(context, 1, &device, &size, (const unsigned char **)&bin, &status, &err);
+	free(bin);
+	if(program == NULL || err != CL_SUCCESS || status != CL_SUCCESS){
+		if(program) clReleaseProgram(program);
+		return NULL;
+	}
+
+	// still needed for binaries, but no compilation happens
+	if(clBuildProgram(program, 1, &device, options ? options : "", NULL, NULL) != CL_SUCCESS){
+		clReleaseProgram(program);
+		return NULL;
+	}
+	return program;
+}
+
+static void clutl_cache_save(cl_program program, const char * path)
+{
+	size_t size = 0;
+	std::vector<char> tmp(strlen(path) + 32);
+
+	if(clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) != CL_SUCCESS || size == 0)
+		return;
+
+	unsigned char * bin = (unsigned char *)malloc(size);
+	if(clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(bin), &bin, NULL) == CL_SUCCESS){
+		// write aside & rename, so concurrent runs never see a partial file
+		// (multi_myGEMM builds from several threads)
+		static std::atomic<unsigned> seq(0);
+		snprintf(tmp.data(), tmp.size(), "%s.%d.%u", path, (int)getpid(), seq++);
+		FILE * fp = fopen(tmp.data(), "wb");
+		if(fp){
+			size_t n = fwrite(bin, 1, size, fp);
+			fclose(fp);
+			if(n != size || rename(tmp.data(), path))
+				unlink(tmp.data());
+		}
+	}
+	free(bin);
+}
+
 int
 clutl_build_program(
 		cl_context context,
 		cl_device_id device,
 		const char * filename,
+		const char * options,
 		cl_program *ptr_program)
 {
-	// Compile the kernel
-	const char * kernelstring = load_src(filename);
+	size_t src_size = 0;
+	char cache_path[1024];
+	int cached;
+
+	const char * kernelstring = load_src(filename, &src_size);
 	if(kernelstring == NULL){
 		fprintf(stderr, ">>> clutl_build_kernel: load_src(%s) error\n", filename);
 		return 1;
 	}
 
-	cl_program program = clCreateProgramWithSource(context, 1, &kernelstring, NULL, NULL);
-	clBuildProgram(program, 0, NULL, "", NULL, NULL);
+	cached = clutl_cache_path(device, options, kernelstring, src_size, cache_path, sizeof(cache_path));
+	if(cached && access(cache_path, R_OK) == 0){
+		cl_program program = clutl_cache_load(context, device, cache_path, options);
+		if(program){
+			free((void*)kernelstring);
+			*ptr_program = program;
+			return 0;
+		}
+		fprintf(stderr, ">>> %s is rejected by the driver, rebuild from source\n", cache_path);
+	}
+
+	// Compile the kernel
+	cl_program program = clCreateProgramWithSource(context, 1, &kernelstring, &src_size, NULL);
+	cl_int err = clBuildProgram(program, 1, &device, options ? options : "", NULL, NULL);
 
 	free((void*)kernelstring);
 
@@ -471,6 +2171,15 @@ clutl_build_program(
 	if (logSize > 10) { fprintf(stderr, ">>> Compiler message: %s\n", messages); }
 	free(messages);
 
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, ">>> clBuildProgram(%s) failed: %s\n", options ? options : "", clutl_GetErrorString(err));
+		clReleaseProgram(program);
+		return 1;
+	}
+
+	if(cached)
+		clutl_cache_save(program, cache_path);
+
 	*ptr_program = program;
 	return 0;
 }
@@ -509,9 +2218,11 @@ clutl_platform_select(
 #define cntof(x) sizeof(x)/sizeof(x[0])
 
     /* Get Platform and Device Info */
-    clGetPlatformIDs(sizeof(platform_id)/sizeof(platform_id[0]),
+    ret = clGetPlatformIDs(sizeof(platform_id)/sizeof(platform_id[0]),
     				platform_id,
 					&ret_num_platforms);
+	if(ret != CL_SUCCESS)
+		ret_num_platforms = 0;
 
 	printf("Total %d Platforms:\n", ret_num_platforms);
 	for(i=0; i<ret_num_platforms; i++) {
@@ -537,7 +2248,10 @@ clutl_platform_select(
 
     printf("\n\n");
 
-	if(select_id > 0){
+	if(ret_num_platforms == 0 || select_id > (int)ret_num_platforms){
+		*ptr_platform_id = 0;
+		return -1;
+	}else if(select_id > 0){
 		*ptr_platform_id = platform_id[select_id - 1];
 		return 0;
 	}else{
@@ -545,3 +2259,79 @@ clutl_platform_select(
 		return ret_num_platforms;
 	}
 }
+
+/* spec: platform number (1 based) or part of its name/vendor, case insensitive
+ * return: platform number, 0 if nothing matches */
+int
+clutl_platform_find(const char * spec)
+{
+	cl_platform_id platform_id[32];
+	cl_uint n = 0;
+	char name[256], vendor[256];
+
+	if(isdigit(spec[0]))
+		return atoi(spec);
+
+	clGetPlatformIDs(sizeof(platform_id)/sizeof(platform_id[0]), platform_id, &n);
+	for(cl_uint i = 0; i < n; i++){
+		name[0] = vendor[0] = 0;
+		clGetPlatformInfo(platform_id[i], CL_PLATFORM_NAME, sizeof(name), name, NULL);
+		clGetPlatformInfo(platform_id[i], CL_PLATFORM_VENDOR, sizeof(vendor), vendor, NULL);
+		if(strcasestr(name, spec) || strcasestr(vendor, spec))
+			return i + 1;
+	}
+	return 0;
+}
+
+/* devices of platform matching spec:
+ *   NULL or ""                          the default device
+ *   N                                   N-th device (1 based)
+ *   cpu|gpu|accelerator|default|all     by type
+ *   otherwise                           part of the device name, case insensitive
+ * return: number of devices put into devices[max] */
+int
+clutl_device_list(cl_platform_id platform_id, const char * spec, cl_device_id * devices, int max)
+{
+	static const struct {
+		const char *	name;
+		cl_device_type	type;
+	} types[] = {
+		{"default",		CL_DEVICE_TYPE_DEFAULT},
+		{"cpu",			CL_DEVICE_TYPE_CPU},
+		{"gpu",			CL_DEVICE_TYPE_GPU},
+		{"accelerator",	CL_DEVICE_TYPE_ACCELERATOR},
+		{"all",			CL_DEVICE_TYPE_ALL},
+	};
+	cl_device_id all[32];
+	cl_uint n = 0;
+	int cnt = 0;
+
+	if(spec == NULL || spec[0] == 0)
+		spec = "default";
+
+	for(unsigned i = 0; i < cntof(types); i++)
+		if(strcasecmp(spec, types[i].name) == 0){
+			if(clGetDeviceIDs(platform_id, types[i].type, max, devices, &n) != CL_SUCCESS)
+				return 0;
+			return (int)n < max ? (int)n : max;
+		}
+
+	if(clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ALL, cntof(all), all, &n) != CL_SUCCESS)
+		return 0;
+	if(n > cntof(all)) n = cntof(all);
+
+	if(isdigit(spec[0])){
+		unsigned i = atoi(spec);
+		if(i < 1 || i > n || max < 1) return 0;
+		devices[0] = all[i - 1];
+		return 1;
+	}
+
+	for(cl_uint i = 0; i < n && cnt < max; i++){
+		char name[256] = "";
+		clGetDeviceInfo(all[i], CL_DEVICE_NAME, sizeof(name), name, NULL);
+		if(strcasestr(name, spec))
+			devices[cnt++] = all[i];
+	}
+	return cnt;
+}
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "pipeline.h"
+
+/*
+ * pipeline.h latency & throughput benchmark
+ *
+ *   tpipeline [frames] [spin]
+ *
+ * synthetic detect/track style chains, every stage costs a fixed time per
+ * frame (a sleep, or a busy loop with "spin" so stages compete for cores).
+ * each chain runs twice:
+ *   max     frames are pushed as fast as the pipeline takes them
+ *   paced   frames are pushed at 80% of the max rate, like a camera
+ * reported: fps, push-to-pop latency percentiles in us, and per stage how
+ * many frames it ran on / let through and how busy its workers were.
+ */
+
+struct frame
+{
+    int         id;
+    uint64_t    sum;
+};
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool g_spin = false;
+
+static void work(frame & f, int us)
+{
+    if(!g_spin) {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+        f.sum += us;
+        return;
+    }
+    uint64_t end = now_ns() + us * 1000ull;
+    while(now_ns() < end) f.sum++;
+}
+
+struct stage_cfg
+{
+    const char *    name;
+    int             cost_us;
+    int             workers;
+    int             every;      // run on 1 frame in "every", 1 = all
+};
+
+struct chain_cfg
+{
+    const char *    name;
+    stage_cfg       stages[5];
+    int             nstage;
+};
+
+static const chain_cfg chains[] = {
+    {"track",           {{"track", 2000, 1, 1}}, 1},
+    {"detect/4 x1",     {{"detect", 20000, 1, 4}, {"track", 2000, 1, 1}}, 2},
+    {"detect/4 x2",     {{"detect", 20000, 2, 4}, {"track", 2000, 1, 1}}, 2},
+    {"detect/4 x4",     {{"detect", 20000, 4, 4}, {"track", 2000, 1, 1}}, 2},
+    {"detect/1 x4",     {{"detect", 20000, 4, 1}, {"track", 2000, 1, 1}}, 2},
+    {"5 stage",         {{"decode", 3000, 1, 1}, {"resize", 1000, 1, 1},
+                         {"detect", 20000, 2, 4}, {"track", 2000, 1, 1},
+                         {"encode", 4000, 2, 1}}, 5},
+};
+
+// return: fps
+static double run_chain(const chain_cfg & c, int nframes, double push_fps)
+{
+    pipeline<frame> pl;
+    for(int i = 0; i < c.nstage; i++) {
+        const stage_cfg & s = c.stages[i];
+        int us = s.cost_us;
+        pl.stage(s.name, [us](frame & f){ work(f, us); }, s.workers,
+                 s.every > 1 ? pipeline<frame>::every(s.every) : pipeline<frame>::stage_rule());
+    }
+    pl.start();
+
+    uint64_t t0 = now_ns();
+    std::thread producer([&]{
+        for(int i = 0; i < nframes; i++) {
+            if(push_fps > 0) {
+                uint64_t due = t0 + (uint64_t)(i * 1e9 / push_fps);
+                uint64_t t = now_ns();
+                if(t < due) std::this_thread::sleep_for(std::chrono::nanoseconds(due - t));
+            }
+            frame f;
+            f.id = i;
+            f.sum = 0;
+            pl.push(f);
+        }
+        pl.close();
+    });
+
+    std::vector<uint64_t> lat;
+    frame f;
+    uint64_t ns;
+    int next = 0, out_of_order = 0;
+    while(pl.pop(f, &ns)) {
+        if(f.id != next) out_of_order++;
+        next = f.id + 1;
+        lat.push_back(ns);
+    }
+    uint64_t t1 = now_ns();
+    producer.join();
+    pl.join();
+
+    std::sort(lat.begin(), lat.end());
+    size_t n = lat.size();
+    double fps = n / ((t1 - t0) * 1e-9);
+    printf("%-14s %-6s %8.1f | %7llu %7llu %7llu %7llu |",
+           c.name, push_fps > 0 ? "paced" : "max", fps,
+           (unsigned long long)lat[n * 50 / 100] / 1000, (unsigned long long)lat[n * 90 / 100] / 1000,
+           (unsigned long long)lat[n * 99 / 100] / 1000, (unsigned long long)lat[n - 1] / 1000);
+    for(int i = 0; i < pl.stages(); i++) {
+        const pipeline<frame>::stage_stats & st = pl.stats(i);
+        // busy: share of the wall time the stage's workers spent in it
+        printf(" %s run=%llu skip=%llu busy=%.0f%%", pl.stage_name(i),
+               (unsigned long long)st.run.load(), (unsigned long long)st.bypassed.load(),
+               st.busy_ns.load() * 100.0 / ((t1 - t0) * (double)pl.stage_workers(i)));
+    }
+    if(out_of_order) printf(" OUT OF ORDER %d", out_of_order);
+    printf("\n");
+    return fps;
+}
+
+int main(int argc, char * argv[])
+{
+    int nframes = argc > 1 ? atoi(argv[1]) : 200;
+    g_spin = argc > 2 && strcmp(argv[2], "spin") == 0;
+    if(nframes < 1) nframes = 1;
+
+    printf("%d frames, stage cost by %s, %u cores, latency in us\n",
+           nframes, g_spin ? "busy loop" : "sleep", std::thread::hardware_concurrency());
+    printf("%-14s %-6s %8s | %7s %7s %7s %7s | stages\n",
+           "chain", "push", "fps", "p50", "p90", "p99", "max");
+
+    for(size_t i = 0; i < sizeof(chains)/sizeof(chains[0]); i++) {
+        double fps = run_chain(chains[i], nframes, 0);
+        run_chain(chains[i], nframes, fps * 0.8);
+    }
+    return 0;
+}
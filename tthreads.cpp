@@ -61,6 +61,25 @@ void test1()
 
 #include "thread_queue.h"
 
+void show_queue_stats(const char * name, const blocking_queue_stats & st)
+{
+    uint64_t deq = st.dequeued.load();
+    printf("%s: put=%llu get=%llu max_size=%d avg_in_queue=%.1fus p50<%lluus p99<%lluus"
+           " producer_blocked=%.3fms consumer_starved=%.3fms\n",
+           name,
+           (unsigned long long)st.enqueued.load(), (unsigned long long)deq, st.max_size.load(),
+           deq ? st.in_queue_ns.load()*1e-3/deq : 0.0,
+           (unsigned long long)st.in_queue_percentile_us(50),
+           (unsigned long long)st.in_queue_percentile_us(99),
+           st.producer_blocked_ns.load()*1e-6, st.consumer_starved_ns.load()*1e-6);
+}
+
+template<class T>
+void show_queue_stats(const char * name, blocking_queue<T> & q)
+{
+    show_queue_stats(name, q.stats());
+}
+
 //======================================================================================
 blocking_queue<int> theque;
 
@@ -99,6 +118,7 @@ void test2()
   th2.join();
   th3.join();
   printf("t=%d (%d+%d+%d), max_size=%d\n", (t1+t2+t3), t1,t2,t3, theque.max_size());
+  show_queue_stats("theque", theque);
 }
 
 
@@ -155,12 +175,13 @@ void test3()
   
   printf("t=%d (%d+%d+%d), max_size=%d, ctor:%d  dtor:%d   sque remain:%d\n", (t1+t2+t3), t1,t2,t3, sque.max_size(),
   MyObj::cnt_ctor.load(), MyObj::cnt_dtor.load(), sque.size());
+  show_queue_stats("sque", sque);
 }
 
 //=============================================================================================================
 #include <iostream>
 #include <chrono>
-#include "thread_pool.h"
+#include "pipeline.h"
 
 
 struct obj_result
@@ -180,20 +201,18 @@ public:
     tracker(int id=0):id(id){}
     
     AllResult track(int fid, 
-                    std::shared_future<AllResult> prev, 
-                    std::shared_future<AllResult> det)
+                    const AllResult * prev, 
+                    const AllResult * det)
     {
         std::cout << " >>>>> track:";
         
-        if(prev.valid()){
-            const AllResult& track_res = prev.get();
-            std::cout << "(with track " << track_res.fid << ")";
+        if(prev){
+            std::cout << "(with track " << prev->fid << ")";
             std::cout.flush();
         }
         
-        if(det.valid()){
-            const AllResult& det_res = det.get();
-            std::cout << "(with detect " << det_res.fid << ")";
+        if(det){
+            std::cout << "(with detect " << det->fid << ")";
             std::cout.flush();
         }
         
@@ -233,49 +252,58 @@ public:
     std::chrono::time_point<std::chrono::steady_clock> t0;
 };
 
+// what travels down the pipeline with each frame
+struct FrameCtx
+{
+    int fid;
+    bool has_det;
+    AllResult det;
+    AllResult trk;
+};
+
+// detect every 4th frame (2 detecters in parallel), track every frame in order
 void test4()
 {
-    ThreadPool pool[2] = {{1,10},{1,10}};
-    
-    ThreadPool &th_track  = pool[0];
-    ThreadPool &th_detect = pool[1];
-    
-    int i;
     const int task_cnt = 20;
     
     tracker t(0);
     detecter d;
+    AllResult last_track;
+    bool has_track = false;
     
     EasyTimer t0;
     
-    std::shared_future<AllResult> fprev;
-    std::shared_future<AllResult> fdet;
+    pipeline<FrameCtx> pl;
+    pl.stage("detect", [&d](FrameCtx & f){
+                f.det = d.detect(f.fid);
+                f.has_det = true;
+            }, 2, pipeline<FrameCtx>::every(4));
+    //only one worker, track() sees the frames one by one in order
+    pl.stage("track", [&](FrameCtx & f){
+                f.trk = t.track(f.fid, has_track ? &last_track : NULL, f.has_det ? &f.det : NULL);
+                last_track = f.trk;
+                has_track = true;
+            });
+    pl.start();
     
-    for(i=0;i<task_cnt;i++)
-    {
-        //because only one thread is the pool, track() will be executed sequentially
-        if((i % 4) == 0)
-            fdet = th_detect.enqueue(&detecter::detect, &d, i).share();
-        else
-            fdet = std::shared_future<AllResult>();
-        
-        fprev = th_track.enqueue(&tracker::track, &t, i, fprev, fdet).share();
-    }
-    std::ostringstream out; 
-    out << " ************************ (all " <<  task_cnt << " taskes are enqueued) *********************** " << std::endl; 
-    std::cout << out.str();
+    std::thread producer([&pl, task_cnt]{
+        for(int i=0;i<task_cnt;i++)
+            pl.push(FrameCtx{i, false, {}, {}});
+        pl.close();
+        std::ostringstream out; 
+        out << " ************************ (all " <<  task_cnt << " taskes are enqueued) *********************** " << std::endl; 
+        std::cout << out.str();
+    });
     
-    fprev.get();
+    FrameCtx f;
+    uint64_t lat;
+    while(pl.pop(f, &lat))
+        std::cout << "frame " << f.fid << " done, latency " << lat / 1000000 << " ms" << std::endl;
+    producer.join();
     
     std::cout << "Time consumed:" <<  t0.elapsed<std::chrono::milliseconds>() << " milliseconds" <<  std::endl;
-    
-    //auto d1 = th.enqueue(stage1, std::string("Hello"));
-    
-    //std::future<int> d1 = std::async(stage1, 1);
-    //std::future<int> d2 = std::async(stage2, std::move(d1));
-    //printf(" >>>>> %d\n", (int)d2.get());
-    
-    th_track.stop_all();
+    show_queue_stats("detect queue", pl.queue_stats(0));
+    show_queue_stats("track queue", pl.queue_stats(1));
 }
 
 